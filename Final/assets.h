@@ -0,0 +1,19 @@
+/* assets.h
+ * generated by assetpack, the ids of the assets in assets.bin */
+
+#define background_4bpp_tiles 600
+#define background_4bpp_banks 5
+#define mapBack_width 32
+#define mapBack_height 32
+#define map2_width 32
+#define map2_height 32
+
+/* the id of each asset in the pack */
+enum AssetId {
+    ASSET_BACKGROUND_4BPP_DATA,
+    ASSET_BACKGROUND_4BPP_PALETTE,
+    ASSET_BACKGROUND_TILE_BANK,
+    ASSET_MAPBACK,
+    ASSET_MAP2,
+    ASSET_COUNT
+};
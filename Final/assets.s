@@ -0,0 +1,13 @@
+@ assets.s
+
+@ the asset pack made by tools/assetpack, linked straight into ROM so the
+@ art doesn't have to be compiled as C arrays
+
+    .section .rodata
+    .align 2
+
+@ declare assets as global so trex.c can find it
+.global assets
+
+assets:
+    .incbin "assets.bin"
@@ -0,0 +1,88 @@
+@ interrupt.s
+
+@ the master interrupt handler, the BIOS jumps here through the pointer at
+@ 0x03007FFC on every interrupt, it's ARM code in IWRAM since it runs so often
+@
+@ it takes the most important interrupt that is pending (the lowest bit),
+@ acknowledges it in IF and in the BIOS flags at 0x03007FF8 which IntrWait
+@ and VBlankIntrWait look at, then calls the handler in interrupt_handlers
+@ the handler runs in system mode on the normal stack, and unless it's one of
+@ the interrupt_preempt_mask interrupts itself, those are let in while it runs
+
+    .syntax unified
+    .section .iwram, "ax", %progbits
+    .arm
+    .align 2
+
+@ declare interrupt_master_isr as global so trex.c can install it
+.global interrupt_master_isr
+
+interrupt_master_isr:
+    mov     r0, #0x04000000
+    add     r0, r0, #0x200          @ r0 = the address of IE, IF is right after
+    ldr     r1, [r0]                @ r1 = IE | (IF << 16)
+    and     r1, r1, r1, lsr #16     @ r1 = interrupts which are enabled and pending
+    rsb     r2, r1, #0
+    ands    r2, r2, r1              @ r2 = just the lowest of those
+    bxeq    lr                      @ nothing to do, go back to the BIOS
+
+    @ acknowledge it, writing a 1 to IF clears that bit
+    strh    r2, [r0, #2]
+    ldr     r3, =0x03007FF8
+    ldrh    r1, [r3]
+    orr     r1, r1, r2
+    strh    r1, [r3]
+
+    @ the handler's index in the table is the position of the bit
+    ldr     r3, =interrupt_handlers
+    mov     r1, r2
+1:
+    movs    r1, r1, lsr #1
+    addne   r3, r3, #4
+    bne     1b
+    ldr     r3, [r3]
+    cmp     r3, #0
+    bxeq    lr                      @ no handler for this one
+
+    @ work out which interrupts can preempt this handler, none if it is one
+    @ of the preempting ones itself
+    ldr     r12, =interrupt_preempt_mask
+    ldrh    r12, [r12]
+    tst     r12, r2
+    movne   r12, #0
+
+    @ save IE, the interrupted code's status and where to go back to
+    ldrh    r1, [r0]
+    mrs     r2, spsr
+    stmfd   sp!, {r0, r1, r2, lr}
+
+    @ only leave the preempting interrupts enabled while the handler runs
+    ands    r12, r12, r1
+    strhne  r12, [r0]
+
+    @ switch to system mode, with interrupts on only if we're nesting
+    mrs     r1, cpsr
+    bic     r1, r1, #0xdf
+    orr     r1, r1, #0x1f
+    orreq   r1, r1, #0x80
+    msr     cpsr_c, r1
+
+    @ call the handler, which can be thumb code
+    stmfd   sp!, {r0, lr}
+    mov     lr, pc
+    bx      r3
+    ldmfd   sp!, {r0, lr}
+
+    @ back to irq mode with interrupts off
+    mrs     r1, cpsr
+    bic     r1, r1, #0xdf
+    orr     r1, r1, #0x92
+    msr     cpsr_c, r1
+
+    @ put IE and the status back and return to the BIOS
+    ldmfd   sp!, {r0, r1, r2, lr}
+    strh    r1, [r0]
+    msr     spsr_cxsf, r2
+    bx      lr
+
+    .pool
@@ -0,0 +1,32 @@
+/* jumps.h
+ * generated by jumpgen, the arc of each jump in 1/256 pixels
+ * from the take off point, one entry per tick */
+
+#define JUMP_KOOPA_VELOCITY -1500
+#define JUMP_KOOPA_GRAVITY 90
+#define JUMP_KOOPA_APEX 17
+#define JUMP_KOOPA_LANDING 35
+#define JUMP_KOOPA_HEIGHT 13260
+
+const short jump_koopa [] = {
+        0, -1500, -2910, -4230, -5460, -6600, -7650, -8610, -9480,-10260,
+   -10950,-11550,-12060,-12480,-12810,-13050,-13200,-13260,-13230,-13110,
+   -12900,-12600,-12210,-11730,-11160,-10500, -9750, -8910, -7980, -6960,
+    -5850, -4650, -3360, -1980,  -510,  1050,
+};
+
+#define JUMP_KOOPA2_VELOCITY -1500
+#define JUMP_KOOPA2_GRAVITY 50
+#define JUMP_KOOPA2_APEX 30
+#define JUMP_KOOPA2_LANDING 61
+#define JUMP_KOOPA2_HEIGHT 23250
+
+const short jump_koopa2 [] = {
+        0, -1500, -2950, -4350, -5700, -7000, -8250, -9450,-10600,-11700,
+   -12750,-13750,-14700,-15600,-16450,-17250,-18000,-18700,-19350,-19950,
+   -20500,-21000,-21450,-21850,-22200,-22500,-22750,-22950,-23100,-23200,
+   -23250,-23250,-23200,-23100,-22950,-22750,-22500,-22200,-21850,-21450,
+   -21000,-20500,-19950,-19350,-18700,-18000,-17250,-16450,-15600,-14700,
+   -13750,-12750,-11700,-10600, -9450, -8250, -7000, -5700, -4350, -2950,
+    -1500,     0,
+};
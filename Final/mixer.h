@@ -0,0 +1,152 @@
+/*
+ * mixer.h
+ * the software sound mixer and the sound effects, kept apart from trex.c so
+ * tools/wavrender can run the very same mixer on the host and write what it
+ * makes to a WAV file
+ *
+ * the mixer only works on the channels and buffers it is given, trex.c owns
+ * those and feeds the result to direct sound A
+ * define MIXER_CODE before including this to put the mixer somewhere, the
+ * game puts it in IWRAM as ARM code
+ */
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#ifndef MIXER_CODE
+#define MIXER_CODE
+#endif
+
+/* there are 280896 cycles per frame, so a timer period of 924 cycles gives
+ * exactly 304 samples each frame which is 18157 samples per second */
+#define SOUND_TIMER_PERIOD 924
+#define SOUND_BUFFER_SIZE 304
+#define SOUND_RATE 18157
+
+/* the most sounds which can play at the same time */
+#define MIXER_CHANNELS 8
+
+/* a sound which is playing, positions are in 1/4096 samples */
+struct SoundChannel {
+    const signed char* data;
+    unsigned int position;
+    unsigned int step;
+    unsigned int length;
+    int volume;
+    int loop;
+};
+
+/* the lengths of the sound effects in samples */
+#define SOUND_JUMP_LENGTH 1536
+#define SOUND_CRASH_LENGTH 3072
+#define SOUND_SQUARE_LENGTH 32
+
+/* make the sound effects, a rising square chirp and a fading noise burst,
+ * and one cycle of a square wave to loop */
+static inline void mixer_make_effects(signed char* jump, signed char* crash, signed char* square) {
+    int phase = 0;
+    for (int i = 0; i < SOUND_JUMP_LENGTH; i++) {
+        int period = 40 - (i * 20) / SOUND_JUMP_LENGTH;
+        int amplitude = 64 * (SOUND_JUMP_LENGTH - i) / SOUND_JUMP_LENGTH;
+        if (++phase >= period) {
+            phase = 0;
+        }
+        jump[i] = (phase < period / 2) ? amplitude : -amplitude;
+    }
+
+    unsigned int lfsr = 0xace1;
+    for (int i = 0; i < SOUND_CRASH_LENGTH; i++) {
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xb400);
+        int amplitude = 100 * (SOUND_CRASH_LENGTH - i) / SOUND_CRASH_LENGTH;
+        crash[i] = (lfsr & 1) ? amplitude : -amplitude;
+    }
+
+    for (int i = 0; i < SOUND_SQUARE_LENGTH; i++) {
+        square[i] = i < SOUND_SQUARE_LENGTH / 2 ? 48 : -48;
+    }
+}
+
+/* start a sound on one of the channels, step is the pitch where 4096 plays
+ * it at SOUND_RATE, volume goes up to 64, returns the channel it's on */
+static inline int mixer_start(struct SoundChannel* channels, const signed char* data,
+        int length, int step, int volume, int loop) {
+    /* use a free channel, or cut off the first one if they're all busy */
+    int channel = 0;
+    for (int i = 0; i < MIXER_CHANNELS; i++) {
+        if (channels[i].data == 0) {
+            channel = i;
+            break;
+        }
+    }
+
+    struct SoundChannel* c = &channels[channel];
+    c->data = 0;
+    c->position = 0;
+    c->step = step;
+    c->length = length << 12;
+    c->volume = volume;
+    c->loop = loop;
+    c->data = data;
+    return channel;
+}
+
+/* mix every playing channel into SOUND_BUFFER_SIZE samples of out, adding
+ * them up in mix first, this has to run once a frame
+ * mix is int since 8 channels at full volume go past what a short holds */
+static MIXER_CODE void mixer_mix(struct SoundChannel* channels, int* mix, signed char* out) {
+    for (int i = 0; i < SOUND_BUFFER_SIZE; i++) {
+        mix[i] = 0;
+    }
+
+    for (int c = 0; c < MIXER_CHANNELS; c++) {
+        struct SoundChannel* channel = &channels[c];
+        const signed char* data = channel->data;
+        if (data == 0) {
+            continue;
+        }
+        unsigned int position = channel->position;
+        unsigned int step = channel->step;
+        unsigned int length = channel->length;
+        int volume = channel->volume;
+
+        int i = 0;
+        while (i < SOUND_BUFFER_SIZE) {
+            /* work out how many samples until the end so the inner loop
+             * doesn't need to check */
+            int left = (length - position + step - 1) / step;
+            int end = i + left;
+            if (end > SOUND_BUFFER_SIZE) {
+                end = SOUND_BUFFER_SIZE;
+            }
+            for (; i < end; i++) {
+                mix[i] += data[position >> 12] * volume;
+                position += step;
+            }
+
+            if (position >= length) {
+                if (channel->loop) {
+                    position -= length;
+                } else {
+                    data = 0;
+                    break;
+                }
+            }
+        }
+
+        channel->position = position;
+        channel->data = data;
+    }
+
+    /* scale back down and clip to 8 bits */
+    for (int i = 0; i < SOUND_BUFFER_SIZE; i++) {
+        int sample = mix[i] >> 6;
+        if (sample > 127) {
+            sample = 127;
+        } else if (sample < -128) {
+            sample = -128;
+        }
+        out[i] = sample;
+    }
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * random.h
+ * the random number generators, kept apart from trex.c so tools/hostbench
+ * can time them and check them on the host with the very same code
+ */
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+/* xorshift32 random numbers, cheap and good enough for gameplay, the state
+ * must never be 0 */
+struct Xorshift {
+    unsigned int state;
+};
+
+/* PCG32 random numbers, a bit slower but better quality */
+struct Pcg {
+    unsigned long long state;
+    unsigned long long increment;
+};
+
+/* seed a xorshift generator */
+static inline void xorshift_seed(struct Xorshift* random, unsigned int seed) {
+    random->state = seed ? seed : 0x2545f491;
+}
+
+/* get the next xorshift number */
+static inline unsigned int xorshift_next(struct Xorshift* random) {
+    unsigned int x = random->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random->state = x;
+    return x;
+}
+
+/* fill an array with xorshift numbers, keeping the state in a register */
+static inline void xorshift_fill(struct Xorshift* random, unsigned int* out, int count) {
+    unsigned int x = random->state;
+    for (int i = 0; i < count; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        out[i] = x;
+    }
+    random->state = x;
+}
+
+/* seed a PCG generator, the stream picks one of 2^63 different sequences */
+static inline void pcg_seed(struct Pcg* random, unsigned long long seed, unsigned int stream) {
+    random->state = 0;
+    random->increment = ((unsigned long long) stream << 1) | 1;
+    random->state = random->state * 6364136223846793005ULL + random->increment;
+    random->state += seed;
+    random->state = random->state * 6364136223846793005ULL + random->increment;
+}
+
+/* get the next PCG number */
+static inline unsigned int pcg_next(struct Pcg* random) {
+    unsigned long long old = random->state;
+    random->state = old * 6364136223846793005ULL + random->increment;
+    unsigned int shifted = ((old >> 18) ^ old) >> 27;
+    unsigned int rotate = old >> 59;
+    return (shifted >> rotate) | (shifted << ((-rotate) & 31));
+}
+
+/* fill an array with PCG numbers */
+static inline void pcg_fill(struct Pcg* random, unsigned int* out, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = pcg_next(random);
+    }
+}
+
+/* how many numbers the chi square test takes */
+#define RANDOM_CHI_COUNT 4096
+
+/* 16 buckets is 15 degrees of freedom, a good generator only goes over this
+ * about one time in a thousand */
+#define RANDOM_CHI_LIMIT 38
+
+/* spread RANDOM_CHI_COUNT numbers into 16 buckets by the 4 bits at shift
+ * and return the chi square, which should be about 15 */
+static inline unsigned int random_chi(const unsigned int* numbers, int shift) {
+    int buckets[16] = {0};
+    for (int i = 0; i < RANDOM_CHI_COUNT; i++) {
+        buckets[(numbers[i] >> shift) & 15]++;
+    }
+
+    /* the expected count in each bucket is 256 */
+    unsigned int chi = 0;
+    for (int i = 0; i < 16; i++) {
+        int d = buckets[i] - RANDOM_CHI_COUNT / 16;
+        chi += d * d;
+    }
+    return chi / (RANDOM_CHI_COUNT / 16);
+}
+
+/* check both the top bits and the bottom bits, since the game masks off the
+ * bottom ones, returns 1 if the numbers pass */
+static inline int random_check(const unsigned int* numbers) {
+    return random_chi(numbers, 28) < RANDOM_CHI_LIMIT &&
+        random_chi(numbers, 0) < RANDOM_CHI_LIMIT;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * ring.h
+ * single producer single consumer ring buffers, for passing things between
+ * interrupt handlers and the main loop without turning interrupts off, kept
+ * apart from trex.c so tools/ringtest can run the same code on two threads
+ *
+ * only the producer writes head and only the consumer writes tail, both
+ * count up forever and are masked to get an index so size must be a power
+ * of 2, and head - tail is how many items are in it
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#if defined(__ARM_ARCH) && __ARM_ARCH < 6
+/* the ARM7 has no cache and does its loads and stores in order, so the only
+ * barrier needed is one that stops the compiler moving the item copy to the
+ * other side of the index update */
+#define RING_BARRIER() __asm__ volatile ("" ::: "memory")
+#else
+/* a host with several cores can let another core see the loads and stores
+ * out of order, so it needs a real fence */
+#define RING_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/* define struct name holding size items of type, with name_push, name_peek,
+ * name_pop and name_count to use it, the push and pop return 0 if it's full
+ * or empty */
+#define RING_DEFINE(name, type, size) \
+    typedef char name##_size_is_a_power_of_2[((size) & ((size) - 1)) == 0 ? 1 : -1]; \
+    struct name { \
+        volatile unsigned int head; \
+        volatile unsigned int tail; \
+        type items[size]; \
+    }; \
+    static inline int name##_push(struct name* ring, const type* item) { \
+        unsigned int head = ring->head; \
+        if (head - ring->tail >= (size)) { \
+            return 0; \
+        } \
+        RING_BARRIER(); \
+        ring->items[head & ((size) - 1)] = *item; \
+        RING_BARRIER(); \
+        ring->head = head + 1; \
+        return 1; \
+    } \
+    static inline int name##_peek(struct name* ring, type* item) { \
+        unsigned int tail = ring->tail; \
+        if (ring->head == tail) { \
+            return 0; \
+        } \
+        RING_BARRIER(); \
+        *item = ring->items[tail & ((size) - 1)]; \
+        return 1; \
+    } \
+    static inline int name##_pop(struct name* ring, type* item) { \
+        if (!name##_peek(ring, item)) { \
+            return 0; \
+        } \
+        RING_BARRIER(); \
+        ring->tail = ring->tail + 1; \
+        return 1; \
+    } \
+    static inline unsigned int name##_count(struct name* ring) { \
+        return ring->head - ring->tail; \
+    }
+
+#endif
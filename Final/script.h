@@ -0,0 +1,76 @@
+/*
+ * script.h
+ * the actor scripts, kept apart from trex.c so tools/hostbench can run them
+ * on the host with the very same code
+ */
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+/* a script is a function which can stop partway through and carry on from
+ * the same place the next time it's called, so an actor can do something
+ * that takes many frames without a state machine of its own
+ * it works by keeping the line it stopped on and switching back to it, so
+ * scripts can't use a switch of their own or keep locals across a yield */
+struct Script {
+    /* the line to pick up from, 0 is the start */
+    int line;
+
+    /* counts down while waiting */
+    int timer;
+};
+
+/* these go at the start and end of a script function, which returns 0 while
+ * the script is still going and 1 once it runs off the end */
+#define SCRIPT_BEGIN(s) switch ((s)->line) { case 0:
+#define SCRIPT_END(s) } (s)->line = 0; return 1
+
+/* the waits run on into the case label they add, which is on purpose */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define SCRIPT_FALL_THROUGH __attribute__((fallthrough))
+#else
+#define SCRIPT_FALL_THROUGH
+#endif
+
+/* stop here until the next time the script is run */
+#define SCRIPT_YIELD(s) \
+    do { (s)->line = __LINE__; return 0; case __LINE__:; } while (0)
+
+/* stop here until a condition is true */
+#define SCRIPT_WAIT_UNTIL(s, condition) \
+    do { (s)->line = __LINE__; SCRIPT_FALL_THROUGH; \
+         case __LINE__: if (!(condition)) return 0; } while (0)
+
+/* stop here for some number of runs */
+#define SCRIPT_WAIT_TICKS(s, ticks) \
+    do { (s)->timer = (ticks); (s)->line = __LINE__; SCRIPT_FALL_THROUGH; \
+         case __LINE__: if ((s)->timer-- > 0) return 0; } while (0)
+
+/* start a script over from the beginning */
+static inline void script_reset(struct Script* script) {
+    script->line = 0;
+    script->timer = 0;
+}
+
+/* a small actor used to time running lots of scripts at once, it steps
+ * forward, then back and waits 3 runs, so x is 1 every fourth run */
+struct BenchActor {
+    struct Script script;
+    int x;
+};
+
+static inline int bench_script(struct BenchActor* actor) {
+    SCRIPT_BEGIN(&actor->script);
+    while (1) {
+        actor->x++;
+        SCRIPT_YIELD(&actor->script);
+        actor->x--;
+        SCRIPT_WAIT_TICKS(&actor->script, 3);
+    }
+    SCRIPT_END(&actor->script);
+}
+
+/* how many scripts are timed at once */
+#define BENCH_SCRIPTS 100
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * tile.h
+ * looking up the tiles under points and boxes on a map, kept apart from
+ * trex.c so tools/hostbench can time them and check them against each other
+ * on the host with the very same code
+ */
+
+#ifndef TILE_H
+#define TILE_H
+
+/* one bit for each of the 1024 tile numbers, set if it is ground, trex.c
+ * fills it in ground_build */
+extern unsigned int tile_solid[1024 / 32];
+
+/* finds which tile a screen coordinate maps to, taking scroll into account */
+static inline unsigned short tile_lookup(int x, int y, int xscroll, int yscroll,
+        const unsigned short* tilemap, int tilemap_w, int tilemap_h) {
+
+    /* adjust for the scroll */
+    x += xscroll;
+    y += yscroll;
+
+    /* convert from screen coordinates to tile coordinates */
+    x >>= 3;
+    y >>= 3;
+
+    /* account for wraparound */
+    while (x >= tilemap_w) {
+        x -= tilemap_w;
+    }
+    while (y >= tilemap_h) {
+        y -= tilemap_h;
+    }
+    while (x < 0) {
+        x += tilemap_w;
+    }
+    while (y < 0) {
+        y += tilemap_h;
+    }
+
+    /* lookup this tile from the map */
+    int index = y * tilemap_w + x;
+
+    /* return the tile */
+    return tilemap[index];
+}
+
+/* the most points tile_query_box can check, one bit of the result each */
+#define QUERY_MAX_SAMPLES 32
+
+/* how many samples tile_query_box takes across a size, one every 8 pixels
+ * and one on the far edge */
+static inline int tile_query_samples(int size) {
+    return (size - 1) / 8 + 1 + ((size - 1) % 8 != 0);
+}
+
+/* check a box against the map in one go instead of a tile_lookup per point
+ * the box is sampled at its corners and every 8 pixels in between, and bit
+ * row * columns + column of the result is set if that point is on a solid
+ * tile, the number of sample columns is returned through columns
+ * the wrapped tile column of each sample is worked out once and each row
+ * only needs its row pointer, a box with more than 32 samples or no size
+ * gets 0 back with 0 columns
+ * nothing in the game collides with tiles yet (the koopas land on the
+ * ground_height table and obstacles are sprites), so for now only
+ * tile_query_benchmark and tools/hostbench use this */
+static inline unsigned int tile_query_box(int x, int y, int width, int height, int xscroll, int yscroll,
+        const unsigned short* tilemap, int tilemap_w, int tilemap_h, int* columns) {
+    int tx[QUERY_MAX_SAMPLES];
+    int num_columns = 0, num_rows = 0;
+
+    if (width < 1 || height < 1 ||
+            tile_query_samples(width) * tile_query_samples(height) > QUERY_MAX_SAMPLES) {
+        if (columns) {
+            *columns = 0;
+        }
+        return 0;
+    }
+
+    /* the tile column of each sample, the last one is the right edge */
+    x += xscroll;
+    for (int dx = 0; ; dx += 8) {
+        if (dx > width - 1) {
+            dx = width - 1;
+        }
+        int column = (x + dx) >> 3;
+        while (column >= tilemap_w) {
+            column -= tilemap_w;
+        }
+        while (column < 0) {
+            column += tilemap_w;
+        }
+        tx[num_columns++] = column;
+        if (dx == width - 1) {
+            break;
+        }
+    }
+
+    unsigned int result = 0;
+    int bit = 0;
+    y += yscroll;
+    for (int dy = 0; ; dy += 8) {
+        if (dy > height - 1) {
+            dy = height - 1;
+        }
+        int row = (y + dy) >> 3;
+        while (row >= tilemap_h) {
+            row -= tilemap_h;
+        }
+        while (row < 0) {
+            row += tilemap_h;
+        }
+
+        const unsigned short* line = tilemap + row * tilemap_w;
+        for (int c = 0; c < num_columns; c++, bit++) {
+            int tile = line[tx[c]] & 0x3ff;
+            if (tile_solid[tile >> 5] & (1u << (tile & 31))) {
+                result |= 1u << bit;
+            }
+        }
+        num_rows++;
+        if (dy == height - 1) {
+            break;
+        }
+    }
+
+    if (columns) {
+        *columns = num_columns;
+    }
+    return result;
+}
+
+#endif
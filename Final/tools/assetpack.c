@@ -0,0 +1,232 @@
+/*
+ * assetpack.c
+ * host tool which packs arrays from asset headers into one binary blob with
+ * a table of contents, so the game can link the blob in with .incbin instead
+ * of compiling huge C arrays
+ *
+ * usage: assetpack out.bin out.h header.h:array:type [header.h:array:type ...]
+ *
+ * type is one of data, tiles, palette or map
+ * out.h gets an id for each asset plus the #defines from the headers
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_ASSETS 64
+
+/* these have to match what trex.c expects */
+#define PACK_MAGIC "PACK"
+#define PACK_VERSION 1
+
+/* every asset starts on a 4 byte boundary so it can be copied with 32 bit DMA */
+#define PACK_ALIGN 4
+
+/* the kinds of assets */
+const char* type_names[] = { "data", "tiles", "palette", "map" };
+#define NUM_TYPES 4
+
+/* an entry in the table of contents, 16 bytes, written out little endian */
+struct Entry {
+    unsigned short id;
+    unsigned char type;
+    unsigned char compression;
+    unsigned int offset;
+    unsigned int size;
+    unsigned int alignment;
+};
+
+struct Entry entries[MAX_ASSETS];
+unsigned char* contents[MAX_ASSETS];
+char names[MAX_ASSETS][128];
+
+/* read a whole file into memory */
+char* read_file(const char* name) {
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        fprintf(stderr, "assetpack: can't open %s\n", name);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    size = fread(text, 1, size, f);
+    text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+/* find an array by name and read its values as bytes, returns the size */
+unsigned int parse_array(const char* text, const char* name, unsigned char** out) {
+    int len = strlen(name);
+    for (const char* p = strstr(text, name); p; p = strstr(p + 1, name)) {
+        /* it has to be the whole name followed by [] */
+        if ((p > text && (isalnum((unsigned char) p[-1]) || p[-1] == '_'))) {
+            continue;
+        }
+        const char* q = p + len;
+        while (*q == ' ') {
+            q++;
+        }
+        if (q[0] != '[' || q[1] != ']') {
+            continue;
+        }
+
+        /* the element size comes from the type in front of the name */
+        const char* line = p;
+        while (line > text && line[-1] != '\n') {
+            line--;
+        }
+        int element = 1;
+        if (strstr(line, "short") && strstr(line, "short") < p) {
+            element = 2;
+        } else if (strstr(line, "int") && strstr(line, "int") < p) {
+            element = 4;
+        }
+
+        const char* brace = strchr(q, '{');
+        const char* close = strchr(q, '}');
+        unsigned int size = 0, capacity = 4096;
+        *out = malloc(capacity);
+        for (const char* c = brace + 1; c < close; ) {
+            if (isdigit((unsigned char) *c)) {
+                char* next;
+                unsigned long v = strtoul(c, &next, 0);
+                if (size + element > capacity) {
+                    capacity *= 2;
+                    *out = realloc(*out, capacity);
+                }
+                for (int b = 0; b < element; b++) {
+                    (*out)[size++] = (v >> (b * 8)) & 0xff;
+                }
+                c = next;
+            } else {
+                c++;
+            }
+        }
+        return size;
+    }
+    fprintf(stderr, "assetpack: no array named %s\n", name);
+    exit(1);
+}
+
+/* write a number little endian */
+void put(FILE* f, unsigned int value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc((value >> (i * 8)) & 0xff, f);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: assetpack out.bin out.h header.h:array:type ...\n");
+        return 1;
+    }
+    int count = argc - 3;
+    if (count > MAX_ASSETS) {
+        fprintf(stderr, "assetpack: too many assets\n");
+        return 1;
+    }
+
+    FILE* header = fopen(argv[2], "w");
+    if (!header) {
+        fprintf(stderr, "assetpack: can't write %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(header, "/* %s\n * generated by assetpack, the ids of the assets in %s */\n\n",
+            argv[2], argv[1]);
+
+    /* the data starts after the header and the table of contents */
+    unsigned int offset = 8 + count * 16;
+    char last_file[512] = "";
+    for (int i = 0; i < count; i++) {
+        char spec[512];
+        snprintf(spec, sizeof(spec), "%s", argv[i + 3]);
+        char* file = strtok(spec, ":");
+        char* array = strtok(NULL, ":");
+        char* type = strtok(NULL, ":");
+        if (!file || !array || !type) {
+            fprintf(stderr, "assetpack: %s should be header.h:array:type\n", argv[i + 3]);
+            return 1;
+        }
+
+        int t = 0;
+        while (t < NUM_TYPES && strcmp(type_names[t], type) != 0) {
+            t++;
+        }
+        if (t == NUM_TYPES) {
+            fprintf(stderr, "assetpack: unknown type %s\n", type);
+            return 1;
+        }
+
+        char* text = read_file(file);
+        struct Entry* entry = &entries[i];
+        entry->id = i;
+        entry->type = t;
+        entry->compression = 0;
+        entry->alignment = PACK_ALIGN;
+        entry->size = parse_array(text, array, &contents[i]);
+        offset = (offset + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1);
+        entry->offset = offset;
+        offset += entry->size;
+        snprintf(names[i], sizeof(names[i]), "%s", array);
+
+        /* carry over the sizes and such the header defines, once per file */
+        if (strcmp(file, last_file) != 0) {
+            for (char* line = strstr(text, "#define"); line; line = strstr(line + 1, "#define")) {
+                int len = strcspn(line, "\n");
+                fprintf(header, "%.*s\n", len, line);
+            }
+            snprintf(last_file, sizeof(last_file), "%s", file);
+        }
+        free(text);
+        fprintf(stderr, "%-28s %-8s %8u bytes at 0x%05x\n", array, type, entry->size, entry->offset);
+    }
+
+    fprintf(header, "\n/* the id of each asset in the pack */\nenum AssetId {\n");
+    for (int i = 0; i < count; i++) {
+        char id[128];
+        int j;
+        for (j = 0; names[i][j] && j < 127; j++) {
+            id[j] = toupper((unsigned char) names[i][j]);
+        }
+        id[j] = '\0';
+        fprintf(header, "    ASSET_%s,\n", id);
+    }
+    fprintf(header, "    ASSET_COUNT\n};\n");
+    fclose(header);
+
+    /* now the blob: magic, version, count, the entries, then the data */
+    FILE* out = fopen(argv[1], "wb");
+    if (!out) {
+        fprintf(stderr, "assetpack: can't write %s\n", argv[1]);
+        return 1;
+    }
+    fwrite(PACK_MAGIC, 1, 4, out);
+    put(out, PACK_VERSION, 2);
+    put(out, count, 2);
+    for (int i = 0; i < count; i++) {
+        put(out, entries[i].id, 2);
+        put(out, entries[i].type, 1);
+        put(out, entries[i].compression, 1);
+        put(out, entries[i].offset, 4);
+        put(out, entries[i].size, 4);
+        put(out, entries[i].alignment, 4);
+    }
+    unsigned int position = 8 + count * 16;
+    for (int i = 0; i < count; i++) {
+        while (position < entries[i].offset) {
+            fputc(0, out);
+            position++;
+        }
+        fwrite(contents[i], 1, entries[i].size, out);
+        position += entries[i].size;
+        free(contents[i]);
+    }
+    fclose(out);
+    fprintf(stderr, "%s: %d assets, %u bytes\n", argv[1], count, position);
+    return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * gba4bpp.c
+ * host tool which converts an 8bpp image header made by png2gba into 4bpp
+ * tiles with the colors split into 16 color palette banks
+ *
+ * usage: gba4bpp [-s] image.h [map.h ...] > image4.h
+ *
+ * if tile maps are given, only the tiles they use are converted (the rest are
+ * left blank so tile indices don't change), otherwise every tile is
+ * -s puts every tile in the same bank, which is what sprites need
+ * a report of the bytes saved is written to stderr and into the output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_TILES 1024
+#define NUM_BANKS 16
+
+/* each bank has 15 usable colors since entry 0 is transparent */
+#define BANK_COLORS 15
+
+/* read a whole file into memory */
+char* read_file(const char* name) {
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        fprintf(stderr, "gba4bpp: can't open %s\n", name);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    size = fread(text, 1, size, f);
+    text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+/* find the array whose name ends with suffix and parse its numbers, returns
+ * the count and the array name through name_out */
+int parse_array(const char* text, const char* suffix, unsigned int** values,
+        char* name_out) {
+    const char* p = text;
+    while ((p = strstr(p, "[]")) != NULL) {
+        /* walk back over the spaces and the name in front of the brackets */
+        const char* end = p;
+        while (end > text && end[-1] == ' ') {
+            end--;
+        }
+        const char* start = end;
+        while (start > text && (isalnum((unsigned char) start[-1]) || start[-1] == '_')) {
+            start--;
+        }
+        int len = end - start;
+        int slen = strlen(suffix);
+        p += 2;
+        if (len < slen || strncmp(end - slen, suffix, slen) != 0) {
+            continue;
+        }
+        memcpy(name_out, start, len);
+        name_out[len] = '\0';
+
+        /* parse the numbers between the braces */
+        const char* brace = strchr(p, '{');
+        const char* close = strchr(p, '}');
+        int count = 0, capacity = 1024;
+        *values = malloc(capacity * sizeof(unsigned int));
+        for (const char* q = brace + 1; q < close; ) {
+            if (isdigit((unsigned char) *q)) {
+                char* next;
+                unsigned int v = strtoul(q, &next, 0);
+                if (count == capacity) {
+                    capacity *= 2;
+                    *values = realloc(*values, capacity * sizeof(unsigned int));
+                }
+                (*values)[count++] = v;
+                q = next;
+            } else {
+                q++;
+            }
+        }
+        return count;
+    }
+    return 0;
+}
+
+/* the colors used in a tile as a bitmask over the 256 palette entries */
+struct ColorSet {
+    unsigned int bits[8];
+    int count;
+};
+
+void set_add(struct ColorSet* set, int color) {
+    if (!(set->bits[color >> 5] & (1u << (color & 31)))) {
+        set->bits[color >> 5] |= 1u << (color & 31);
+        set->count++;
+    }
+}
+
+/* how many colors the union of two sets would have */
+int union_count(const struct ColorSet* a, const struct ColorSet* b) {
+    int count = 0;
+    for (int i = 0; i < 8; i++) {
+        count += __builtin_popcount(a->bits[i] | b->bits[i]);
+    }
+    return count;
+}
+
+void set_merge(struct ColorSet* a, const struct ColorSet* b) {
+    for (int i = 0; i < 8; i++) {
+        a->bits[i] |= b->bits[i];
+    }
+    a->count = union_count(a, a);
+}
+
+struct ColorSet tile_colors[MAX_TILES];
+int tile_used[MAX_TILES];
+int tile_bank[MAX_TILES];
+struct ColorSet banks[NUM_BANKS];
+int num_banks = 0;
+
+/* sort tiles with the most colors first so the greedy packing does better */
+int by_colors(const void* a, const void* b) {
+    return tile_colors[*(const int*) b].count - tile_colors[*(const int*) a].count;
+}
+
+int main(int argc, char** argv) {
+    int single_bank = 0;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-s") == 0) {
+        single_bank = 1;
+        arg++;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "usage: gba4bpp [-s] image.h [map.h ...] > image4.h\n");
+        return 1;
+    }
+
+    /* read the 8bpp image and its palette */
+    const char* image_file = argv[arg++];
+    char* text = read_file(image_file);
+    char data_name[256], palette_name[256], base[256];
+    unsigned int* data;
+    unsigned int* palette;
+    int data_size = parse_array(text, "_data", &data, data_name);
+    int palette_size = parse_array(text, "_palette", &palette, palette_name);
+    if (data_size == 0 || palette_size == 0) {
+        fprintf(stderr, "gba4bpp: %s has no _data or _palette array\n", image_file);
+        return 1;
+    }
+    strcpy(base, data_name);
+    base[strlen(base) - strlen("_data")] = '\0';
+
+    int num_tiles = data_size / 64;
+    if (num_tiles > MAX_TILES) {
+        fprintf(stderr, "gba4bpp: too many tiles in %s\n", image_file);
+        return 1;
+    }
+
+    /* mark the tiles the maps use, or all of them if there are no maps */
+    if (arg == argc) {
+        for (int i = 0; i < num_tiles; i++) {
+            tile_used[i] = 1;
+        }
+    }
+    for (; arg < argc; arg++) {
+        char* map_text = read_file(argv[arg]);
+        char map_name[256];
+        unsigned int* map;
+        int map_size = parse_array(map_text, "", &map, map_name);
+        for (int i = 0; i < map_size; i++) {
+            int tile = map[i] & 0x3ff;
+            if (tile < num_tiles) {
+                tile_used[tile] = 1;
+            }
+        }
+        free(map);
+        free(map_text);
+    }
+
+    /* find the colors each tile uses, 0 is transparent so doesn't count */
+    int order[MAX_TILES], num_used = 0;
+    for (int i = 0; i < num_tiles; i++) {
+        for (int p = 0; p < 64; p++) {
+            if (data[i * 64 + p] != 0) {
+                set_add(&tile_colors[i], data[i * 64 + p]);
+            }
+        }
+        if (tile_used[i]) {
+            order[num_used++] = i;
+        }
+    }
+    qsort(order, num_used, sizeof(int), by_colors);
+
+    /* pack the tiles into banks, putting each one in the bank it adds the
+     * fewest new colors to */
+    int ok = 1;
+    for (int n = 0; n < num_used && ok; n++) {
+        int tile = order[n];
+        int best = -1, best_growth = 1000;
+        for (int b = 0; b < num_banks; b++) {
+            int total = union_count(&banks[b], &tile_colors[tile]);
+            if (total <= BANK_COLORS && total - banks[b].count < best_growth) {
+                best = b;
+                best_growth = total - banks[b].count;
+            }
+        }
+        if (best < 0 && !(single_bank && num_banks == 1) && num_banks < NUM_BANKS) {
+            best = num_banks++;
+        }
+        if (best < 0) {
+            ok = 0;
+            break;
+        }
+        set_merge(&banks[best], &tile_colors[tile]);
+        tile_bank[tile] = best;
+    }
+
+    int bytes_8bpp = num_tiles * 64 + palette_size * 2;
+    if (!ok) {
+        fprintf(stderr, "gba4bpp: %s: colors don't fit in %d banks, keep it 8bpp\n",
+                image_file, single_bank ? 1 : NUM_BANKS);
+        return 2;
+    }
+
+    /* build each bank's palette and the 8bpp to 4bpp index mapping */
+    unsigned int palette4[NUM_BANKS * 16] = {0};
+    int local[NUM_BANKS][256];
+    for (int b = 0; b < num_banks; b++) {
+        int next = 1;
+        for (int c = 1; c < 256; c++) {
+            if (banks[b].bits[c >> 5] & (1u << (c & 31))) {
+                local[b][c] = next;
+                palette4[b * 16 + next] = c < palette_size ? palette[c] : 0;
+                next++;
+            }
+        }
+    }
+
+    /* entry 0 of bank 0 is the backdrop color */
+    palette4[0] = palette[0];
+
+    int bytes_4bpp = num_tiles * 32 + num_banks * 16 * 2;
+    fprintf(stderr, "%s: %d tiles (%d used), %d banks, %d -> %d bytes, saved %d\n",
+            base, num_tiles, num_used, num_banks, bytes_8bpp, bytes_4bpp,
+            bytes_8bpp - bytes_4bpp);
+
+    /* write the new header */
+    printf("/* %s4.h\n", base);
+    printf(" * generated by gba4bpp from %s\n", image_file);
+    printf(" * %d tiles (%d used), %d palette banks\n", num_tiles, num_used, num_banks);
+    printf(" * 8bpp: %d bytes, 4bpp: %d bytes, saved %d bytes */\n\n",
+            bytes_8bpp, bytes_4bpp, bytes_8bpp - bytes_4bpp);
+    printf("#define %s_4bpp_tiles %d\n", base, num_tiles);
+    printf("#define %s_4bpp_banks %d\n\n", base, num_banks);
+
+    printf("const unsigned char %s_4bpp_data [] = {", base);
+    for (int i = 0; i < num_tiles * 32; i++) {
+        int tile = i / 32;
+        int left = 0, right = 0;
+        if (tile_used[tile]) {
+            int p = data[i * 2], q = data[i * 2 + 1];
+            left = p ? local[tile_bank[tile]][p] : 0;
+            right = q ? local[tile_bank[tile]][q] : 0;
+        }
+        printf("%s0x%02x,", i % 12 == 0 ? "\n    " : " ", left | (right << 4));
+    }
+    printf("\n};\n\n");
+
+    printf("const unsigned short %s_4bpp_palette [] = {", base);
+    for (int i = 0; i < num_banks * 16; i++) {
+        printf("%s0x%04x,", i % 9 == 0 ? "\n    " : " ", palette4[i]);
+    }
+    printf("\n};\n\n");
+
+    /* the bank of each tile, to be or'ed into the map entries at load time */
+    printf("const unsigned char %s_tile_bank [] = {", base);
+    for (int i = 0; i < num_tiles; i++) {
+        printf("%s%d,", i % 16 == 0 ? "\n    " : " ", tile_bank[i]);
+    }
+    printf("\n};\n\n");
+
+    free(data);
+    free(palette);
+    free(text);
+    return 0;
+}
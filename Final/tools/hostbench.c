@@ -0,0 +1,239 @@
+/*
+ * hostbench.c
+ * host program which runs the parts of the game that don't touch the
+ * hardware, timing them and checking their results, so they can be looked
+ * at without an emulator
+ *
+ * usage: hostbench
+ *
+ * build it from Final/tools so it picks up the game's headers:
+ * gcc -O2 -I.. hostbench.c -o hostbench
+ * it exits with 1 if any of the checks fail
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "random.h"
+#include "script.h"
+#include "tile.h"
+
+/* the ground map the game runs on */
+#include "mapBack.h"
+
+/* trex.c fills this from the ground tiles, here it's made up */
+unsigned int tile_solid[1024 / 32];
+
+/* how many times each timed thing is run, the time printed is the average */
+#define REPEATS 10000
+
+/* the time now in nanoseconds */
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* the results go through here so the compiler can't throw the work away */
+volatile unsigned int sink;
+
+/* how many checks have failed */
+int failures = 0;
+
+/* print whether a check passed and count it if it didn't */
+static void check(const char* name, int passed) {
+    printf("  %-40s %s\n", name, passed ? "ok" : "FAILED");
+    if (!passed) {
+        failures++;
+    }
+}
+
+/* seeds are spread the way random_seed_from_input spreads the frame count */
+#define RANDOM_SEEDS 1000
+
+/* the same timings random_benchmark takes on the GBA, and the chi square
+ * test on the game's seed and on a lot of the seeds a player could get */
+static void random_bench() {
+    static unsigned int numbers[RANDOM_CHI_COUNT];
+    struct Xorshift x;
+    struct Pcg p;
+    printf("random numbers\n");
+
+    xorshift_seed(&x, 12345);
+    double start = now();
+    for (int i = 0; i < REPEATS; i++) {
+        xorshift_fill(&x, numbers, 256);
+        sink = numbers[255];
+    }
+    printf("  %-40s %8.1f ns\n", "xorshift, 256 numbers", (now() - start) / REPEATS);
+
+    pcg_seed(&p, 12345, 54);
+    start = now();
+    for (int i = 0; i < REPEATS; i++) {
+        pcg_fill(&p, numbers, 256);
+        sink = numbers[255];
+    }
+    printf("  %-40s %8.1f ns\n", "pcg, 256 numbers", (now() - start) / REPEATS);
+
+    /* the seeds random_benchmark uses have to pass */
+    xorshift_seed(&x, 12345);
+    xorshift_fill(&x, numbers, RANDOM_CHI_COUNT);
+    check("xorshift chi square, seed 12345", random_check(numbers));
+    pcg_seed(&p, 12345, 54);
+    pcg_fill(&p, numbers, RANDOM_CHI_COUNT);
+    check("pcg chi square, seed 12345", random_check(numbers));
+
+    /* a good generator fails about 2 in a thousand by chance, since it's
+     * two tests, so more than 1 in a hundred means it's really biased */
+    int xorshift_failed = 0, pcg_failed = 0;
+    for (unsigned int i = 1; i <= RANDOM_SEEDS; i++) {
+        xorshift_seed(&x, i * 2654435761u);
+        xorshift_fill(&x, numbers, RANDOM_CHI_COUNT);
+        xorshift_failed += !random_check(numbers);
+        pcg_seed(&p, i * 2654435761u, 54);
+        pcg_fill(&p, numbers, RANDOM_CHI_COUNT);
+        pcg_failed += !random_check(numbers);
+    }
+    printf("  %-40s %d and %d of %d\n", "seeds over the chi square limit",
+            xorshift_failed, pcg_failed, RANDOM_SEEDS);
+    check("xorshift chi square, player seeds", xorshift_failed * 100 <= RANDOM_SEEDS);
+    check("pcg chi square, player seeds", pcg_failed * 100 <= RANDOM_SEEDS);
+}
+
+/* the frame of 100 scripts script_benchmark times on the GBA, and a check
+ * that each one is where it should be after every frame */
+static void script_bench() {
+    static struct BenchActor actors[BENCH_SCRIPTS];
+    printf("scripts\n");
+    for (int i = 0; i < BENCH_SCRIPTS; i++) {
+        script_reset(&actors[i].script);
+        actors[i].x = 0;
+    }
+
+    int wrong = 0;
+    double start = now();
+    for (int frame = 0; frame < REPEATS; frame++) {
+        for (int i = 0; i < BENCH_SCRIPTS; i++) {
+            bench_script(&actors[i]);
+        }
+
+        /* it steps forward on the first run and every fourth after that */
+        int x = frame % 4 == 0;
+        for (int i = 0; i < BENCH_SCRIPTS; i++) {
+            wrong += actors[i].x != x;
+        }
+    }
+    printf("  %-40s %8.1f ns\n", "100 scripts, one frame", (now() - start) / REPEATS);
+    check("scripts yield and wait in step", wrong == 0);
+}
+
+/* check a box one tile_lookup per point, sampling the same points in the
+ * same order as tile_query_box, to check it against */
+static unsigned int box_by_points(int x, int y, int width, int height, int xscroll,
+        int yscroll, int* columns) {
+    unsigned int result = 0;
+    int bit = 0;
+    for (int dy = 0; ; dy += 8) {
+        if (dy > height - 1) {
+            dy = height - 1;
+        }
+        *columns = 0;
+        for (int dx = 0; ; dx += 8) {
+            if (dx > width - 1) {
+                dx = width - 1;
+            }
+            int tile = tile_lookup(x + dx, y + dy, xscroll, yscroll,
+                    mapBack, mapBack_width, mapBack_height) & 0x3ff;
+            if (tile_solid[tile >> 5] & (1u << (tile & 31))) {
+                result |= 1u << bit;
+            }
+            bit++;
+            (*columns)++;
+            if (dx == width - 1) {
+                break;
+            }
+        }
+        if (dy == height - 1) {
+            break;
+        }
+    }
+    return result;
+}
+
+/* the 100 koopa sized boxes tile_query_benchmark times on the GBA, and
+ * tile_query_box checked against a tile_lookup per point all over the map,
+ * including off the edges where it wraps */
+static void tile_bench() {
+    printf("tile queries\n");
+
+    /* half of the tile numbers are solid, picked at random, so the results
+     * have plenty of both in them */
+    struct Xorshift x;
+    xorshift_seed(&x, 1);
+    for (int i = 0; i < 1024 / 32; i++) {
+        tile_solid[i] = xorshift_next(&x);
+    }
+
+    int columns;
+    double start = now();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int i = 0; i < 100; i++) {
+            sink = box_by_points(i, 120, 16, 32, i + r, 0, &columns);
+        }
+    }
+    printf("  %-40s %8.1f ns\n", "100 16x32 boxes, tile_lookup", (now() - start) / REPEATS);
+
+    start = now();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int i = 0; i < 100; i++) {
+            sink = tile_query_box(i, 120, 16, 32, i + r, 0, mapBack, mapBack_width,
+                    mapBack_height, 0);
+        }
+    }
+    printf("  %-40s %8.1f ns\n", "100 16x32 boxes, tile_query_box", (now() - start) / REPEATS);
+
+    /* every size up to 32x32, which is 25 samples, at every 3rd pixel */
+    int wrong = 0;
+    for (int width = 1; width <= 32; width++) {
+        for (int height = 1; height <= 32; height++) {
+            for (int p = -300; p < 300; p += 3) {
+                int want_columns, got_columns;
+                unsigned int want = box_by_points(p, 100 - p, width, height, p * 7, -p,
+                        &want_columns);
+                unsigned int got = tile_query_box(p, 100 - p, width, height, p * 7, -p,
+                        mapBack, mapBack_width, mapBack_height, &got_columns);
+                wrong += want != got || want_columns != got_columns;
+            }
+        }
+    }
+    check("tile_query_box matches tile_lookup", wrong == 0);
+
+    /* a box with more samples than bits gets nothing back, and none of the
+     * sizes it does take can go over */
+    int too_big = 0;
+    for (int width = 1; width <= 300; width++) {
+        for (int height = 1; height <= 300; height++) {
+            unsigned int got = tile_query_box(0, 0, width, height, 0, 0, mapBack,
+                    mapBack_width, mapBack_height, &columns);
+            int samples = tile_query_samples(width) * tile_query_samples(height);
+            if (samples > QUERY_MAX_SAMPLES) {
+                too_big += got != 0 || columns != 0;
+            } else {
+                too_big += columns != tile_query_samples(width);
+            }
+        }
+    }
+    check("tile_query_box turns away boxes over 32", too_big == 0);
+}
+
+int main() {
+    random_bench();
+    script_bench();
+    tile_bench();
+
+    if (failures) {
+        fprintf(stderr, "hostbench: %d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * jumpgen.c
+ * host tool which works out the arc of each kind of jump ahead of time, so
+ * the game can look up where a jumping actor is instead of adding up the
+ * velocity every tick
+ *
+ * usage: jumpgen name:velocity:gravity [name:velocity:gravity ...] > jumps.h
+ *
+ * velocity and gravity are in 1/256 pixels per tick the way trex.c has them,
+ * for each jump the header gets the height above the take off point for
+ * every tick until it comes back down, along with the tick it peaks at and
+ * the tick it lands on
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* longer than any jump should take, a second and a half */
+#define MAX_TICKS 90
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: jumpgen name:velocity:gravity ...\n");
+        return 1;
+    }
+
+    printf("/* jumps.h\n * generated by jumpgen, the arc of each jump in 1/256 pixels\n");
+    printf(" * from the take off point, one entry per tick */\n");
+
+    for (int a = 1; a < argc; a++) {
+        char spec[256];
+        snprintf(spec, sizeof(spec), "%s", argv[a]);
+        char* name = strtok(spec, ":");
+        char* velocity_text = strtok(NULL, ":");
+        char* gravity_text = strtok(NULL, ":");
+        if (!name || !velocity_text || !gravity_text) {
+            fprintf(stderr, "jumpgen: %s should be name:velocity:gravity\n", argv[a]);
+            return 1;
+        }
+        int velocity = atoi(velocity_text);
+        int gravity = atoi(gravity_text);
+        if (velocity >= 0 || gravity <= 0) {
+            fprintf(stderr, "jumpgen: %s has to go up and come back down\n", name);
+            return 1;
+        }
+
+        /* step it exactly the way koopa_update does, y += yvel then
+         * yvel += gravity, until it's back at the height it started from */
+        int offsets[MAX_TICKS + 1];
+        int y = 0, yvel = velocity;
+        int apex = 0, landing = 0, height = 0;
+        offsets[0] = 0;
+        for (int tick = 1; tick <= MAX_TICKS; tick++) {
+            y += yvel;
+            yvel += gravity;
+            offsets[tick] = y;
+            if (y < height) {
+                height = y;
+                apex = tick;
+            }
+            if (y >= 0) {
+                landing = tick;
+                break;
+            }
+        }
+        if (!landing) {
+            fprintf(stderr, "jumpgen: %s is still in the air after %d ticks\n", name, MAX_TICKS);
+            return 1;
+        }
+        if (height < -32768) {
+            fprintf(stderr, "jumpgen: %s goes too high for a short\n", name);
+            return 1;
+        }
+
+        char upper[128];
+        int j;
+        for (j = 0; name[j] && j < 127; j++) {
+            upper[j] = toupper((unsigned char) name[j]);
+        }
+        upper[j] = '\0';
+
+        printf("\n#define JUMP_%s_VELOCITY %d\n", upper, velocity);
+        printf("#define JUMP_%s_GRAVITY %d\n", upper, gravity);
+        printf("#define JUMP_%s_APEX %d\n", upper, apex);
+        printf("#define JUMP_%s_LANDING %d\n", upper, landing);
+        printf("#define JUMP_%s_HEIGHT %d\n\n", upper, -height);
+        printf("const short jump_%s [] = {", name);
+        for (int tick = 0; tick <= landing; tick++) {
+            printf("%s%6d,", tick % 10 == 0 ? "\n   " : "", offsets[tick]);
+        }
+        printf("\n};\n");
+
+        fprintf(stderr, "%-12s peaks %5.1f px up on tick %2d, lands on tick %2d\n",
+                name, -height / 256.0, apex, landing);
+    }
+    return 0;
+}
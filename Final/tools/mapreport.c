@@ -0,0 +1,264 @@
+/*
+ * mapreport.c
+ * host tool which reads the map file the linker writes (-Wl,-Map,trex.map)
+ * and reports how much ROM, IWRAM and EWRAM each section and symbol uses
+ *
+ * usage: mapreport [-rom bytes] [-iwram bytes] [-ewram bytes] [-top n] trex.map
+ *
+ * it exits with 1 if any region goes over its budget, so it can be put after
+ * the link step to fail the build
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_SYMBOLS 8192
+#define MAX_SECTIONS 256
+
+/* the memory regions of the GBA we care about */
+enum Region {
+    REGION_ROM,
+    REGION_IWRAM,
+    REGION_EWRAM,
+    REGION_OTHER,
+    REGION_COUNT
+};
+
+const char* region_names[REGION_COUNT] = { "ROM", "IWRAM", "EWRAM", "other" };
+
+/* work out which region an address is in */
+enum Region region_of(unsigned long address) {
+    switch (address >> 24) {
+        case 0x08: case 0x09: return REGION_ROM;
+        case 0x03: return REGION_IWRAM;
+        case 0x02: return REGION_EWRAM;
+        default: return REGION_OTHER;
+    }
+}
+
+/* an output section like .text or .iwram */
+struct Section {
+    char name[128];
+    unsigned long address;
+    unsigned long size;
+
+    /* where it's stored in ROM if it's copied to ram at startup, or 0 */
+    unsigned long load;
+};
+
+/* a symbol with the size worked out from where the next one starts */
+struct Symbol {
+    char name[160];
+    char section[128];
+    char file[128];
+    unsigned long address;
+    unsigned long size;
+};
+
+struct Section sections[MAX_SECTIONS];
+int num_sections = 0;
+struct Symbol symbols[MAX_SYMBOLS];
+int num_symbols = 0;
+
+/* the input section the symbols we read are in */
+unsigned long input_address = 0, input_size = 0;
+char input_file[128] = "";
+int input_first_symbol = 0;
+
+/* give the symbols of the last input section their sizes */
+void finish_input_section() {
+    for (int i = input_first_symbol; i < num_symbols; i++) {
+        unsigned long end = (i + 1 < num_symbols) ? symbols[i + 1].address
+                                                  : input_address + input_size;
+        symbols[i].size = end > symbols[i].address ? end - symbols[i].address : 0;
+    }
+
+    /* an input section with no symbols at all still takes up space */
+    if (input_first_symbol == num_symbols && input_size > 0 && num_symbols < MAX_SYMBOLS) {
+        struct Symbol* symbol = &symbols[num_symbols++];
+        snprintf(symbol->name, sizeof(symbol->name), "(%s)", input_file);
+        strcpy(symbol->section, num_sections ? sections[num_sections - 1].name : "");
+        strcpy(symbol->file, input_file);
+        symbol->address = input_address;
+        symbol->size = input_size;
+    }
+    input_first_symbol = num_symbols;
+    input_size = 0;
+}
+
+/* sort the biggest symbols first */
+int by_size(const void* a, const void* b) {
+    const struct Symbol* x = a;
+    const struct Symbol* y = b;
+    return (y->size > x->size) - (y->size < x->size);
+}
+
+/* a line read ahead to see if it holds wrapped numbers, it's handed out
+ * by next_line before reading any more */
+char lookahead[1024];
+int have_lookahead = 0;
+
+/* read the next line without its newline, returns 0 at the end */
+int next_line(FILE* f, char* line, int size) {
+    if (have_lookahead) {
+        snprintf(line, size, "%s", lookahead);
+        have_lookahead = 0;
+        return 1;
+    }
+    if (!fgets(line, size, f)) {
+        return 0;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    return 1;
+}
+
+/* whether a line is the numbers of a name which wrapped, they are indented
+ * and start with 0x */
+int is_wrapped_numbers(const char* line) {
+    if (!isspace((unsigned char) line[0])) {
+        return 0;
+    }
+    while (isspace((unsigned char) *line)) {
+        line++;
+    }
+    return strncmp(line, "0x", 2) == 0;
+}
+
+int main(int argc, char** argv) {
+    /* by default leave 4K of IWRAM for the stack */
+    unsigned long budget[REGION_COUNT] = { 32 * 1024 * 1024, 28 * 1024, 256 * 1024, 0 };
+    int top = 20;
+    const char* map_name = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-rom") == 0 && i + 1 < argc) {
+            budget[REGION_ROM] = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-iwram") == 0 && i + 1 < argc) {
+            budget[REGION_IWRAM] = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-ewram") == 0 && i + 1 < argc) {
+            budget[REGION_EWRAM] = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-top") == 0 && i + 1 < argc) {
+            top = atoi(argv[++i]);
+        } else {
+            map_name = argv[i];
+        }
+    }
+    if (!map_name) {
+        fprintf(stderr, "usage: mapreport [-rom bytes] [-iwram bytes] [-ewram bytes] [-top n] trex.map\n");
+        return 2;
+    }
+
+    FILE* f = fopen(map_name, "r");
+    if (!f) {
+        fprintf(stderr, "mapreport: can't open %s\n", map_name);
+        return 2;
+    }
+
+    /* skip down to the memory map, the part before it lists discarded and
+     * archive members which we don't want */
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "Linker script and memory map", 28) == 0) {
+            break;
+        }
+    }
+
+    while (next_line(f, line, sizeof(line))) {
+        char name[128], file[128];
+        unsigned long address, size, load;
+
+        /* a section name which was too long has its numbers wrapped onto
+         * the next line, but an empty section has no numbers at all and the
+         * next line is something else, so only join real numbers */
+        char rest[8];
+        if (sscanf(line, "%127s %7s", name, rest) == 1 &&
+                (name[0] == '.' || strcmp(name, "COMMON") == 0)) {
+            char numbers[sizeof(line)];
+            if (next_line(f, numbers, sizeof(numbers))) {
+                if (is_wrapped_numbers(numbers)) {
+                    size_t len = strlen(line);
+                    snprintf(line + len, sizeof(line) - len, " %s",
+                            numbers + strspn(numbers, " \t"));
+                } else {
+                    snprintf(lookahead, sizeof(lookahead), "%s", numbers);
+                    have_lookahead = 1;
+                }
+            }
+        }
+
+        if (line[0] == '.') {
+            /* an output section: .name address size [load address x] */
+            int n = sscanf(line, "%127s 0x%lx 0x%lx load address 0x%lx", name, &address, &size, &load);
+            if (n >= 3 && num_sections < MAX_SECTIONS) {
+                finish_input_section();
+                struct Section* section = &sections[num_sections++];
+                snprintf(section->name, sizeof(section->name), "%s", name);
+                section->address = address;
+                section->size = size;
+                section->load = n == 4 ? load : 0;
+            }
+        } else if (strncmp(line, " .", 2) == 0 || strncmp(line, " COMMON", 7) == 0) {
+            /* an input section: .name address size file */
+            int n = sscanf(line, " %127s 0x%lx 0x%lx %127s", name, &address, &size, file);
+            if (n == 4) {
+                finish_input_section();
+                input_address = address;
+                input_size = size;
+                snprintf(input_file, sizeof(input_file), "%s", file);
+            }
+        } else if (line[0] == ' ' && num_sections > 0 && input_size > 0) {
+            /* a symbol: address name, but not assignments like . = ALIGN */
+            int n = sscanf(line, " 0x%lx %127s", &address, name);
+            if (n == 2 && !strchr(line, '=') && num_symbols < MAX_SYMBOLS
+                    && address >= input_address && address < input_address + input_size) {
+                struct Symbol* symbol = &symbols[num_symbols++];
+                strcpy(symbol->name, name);
+                strcpy(symbol->section, sections[num_sections - 1].name);
+                strcpy(symbol->file, input_file);
+                symbol->address = address;
+                symbol->size = 0;
+            }
+        }
+    }
+    finish_input_section();
+    fclose(f);
+
+    /* add up each region, sections copied to ram at startup count for both
+     * the ram they run in and the ROM they're stored in */
+    unsigned long used[REGION_COUNT] = {0};
+    printf("%-24s %-10s %-10s %10s\n", "section", "address", "region", "bytes");
+    for (int i = 0; i < num_sections; i++) {
+        struct Section* section = &sections[i];
+        if (section->size == 0) {
+            continue;
+        }
+        enum Region region = region_of(section->address);
+        used[region] += section->size;
+        if (section->load && region_of(section->load) == REGION_ROM && region != REGION_ROM) {
+            used[REGION_ROM] += section->size;
+        }
+        printf("%-24s 0x%08lx %-10s %10lu\n", section->name, section->address,
+                region_names[region], section->size);
+    }
+
+    /* then the biggest symbols */
+    qsort(symbols, num_symbols, sizeof(struct Symbol), by_size);
+    printf("\n%-40s %-16s %-10s %10s\n", "symbol", "section", "region", "bytes");
+    for (int i = 0; i < num_symbols && i < top; i++) {
+        printf("%-40s %-16s %-10s %10lu\n", symbols[i].name, symbols[i].section,
+                region_names[region_of(symbols[i].address)], symbols[i].size);
+    }
+
+    /* and the totals against the budgets */
+    int over = 0;
+    printf("\n%-10s %10s %10s %6s\n", "region", "used", "budget", "");
+    for (int r = 0; r < REGION_OTHER; r++) {
+        int bad = used[r] > budget[r];
+        over |= bad;
+        printf("%-10s %10lu %10lu %5lu%%%s\n", region_names[r], used[r], budget[r],
+                budget[r] ? used[r] * 100 / budget[r] : 0, bad ? "  OVER BUDGET" : "");
+    }
+    return over ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * ringtest.c
+ * host program which hammers the rings from ring.h with a producer thread
+ * and a consumer thread on different cores, the way the game has the vblank
+ * interrupt on one end and the main loop on the other, and checks nothing
+ * is lost, repeated, torn or out of order
+ *
+ * usage: ringtest [items]
+ *
+ * build it from Final/tools so it picks up the game's headers:
+ * gcc -O2 -pthread -I.. ringtest.c -o ringtest
+ * it exits with 1 if any of the checks fail
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ring.h"
+
+/* an item bigger than a word, so a copy that is seen half done shows up */
+struct Item {
+    unsigned int sequence;
+    unsigned int check[3];
+};
+
+/* a tiny ring which is full nearly all the time, and one the size of the
+ * game's input ring */
+RING_DEFINE(TinyRing, struct Item, 2)
+RING_DEFINE(InputSizedRing, struct Item, 16)
+
+/* the check words every item with this sequence number should have */
+static void item_make(struct Item* item, unsigned int sequence) {
+    item->sequence = sequence;
+    item->check[0] = sequence * 2654435761u;
+    item->check[1] = ~sequence;
+    item->check[2] = sequence ^ 0x5a5a5a5a;
+}
+
+static int item_good(const struct Item* item) {
+    struct Item want;
+    item_make(&want, item->sequence);
+    return item->check[0] == want.check[0] && item->check[1] == want.check[1] &&
+        item->check[2] == want.check[2];
+}
+
+/* what the consumer found */
+struct Results {
+    unsigned int received;
+    unsigned int torn;
+    unsigned int out_of_order;
+    unsigned int too_full;
+};
+
+/* the same producer and consumer for each kind of ring, the consumer
+ * sometimes peeks before it pops the way input_poll does */
+#define RING_TEST(name, size) \
+    struct name name##_ring; \
+    unsigned int name##_items; \
+    struct Results name##_results; \
+    static void* name##_produce(void* unused) { \
+        (void) unused; \
+        for (unsigned int i = 0; i < name##_items; i++) { \
+            struct Item item; \
+            item_make(&item, i); \
+            while (!name##_push(&name##_ring, &item)) { \
+                sched_yield(); \
+            } \
+        } \
+        return 0; \
+    } \
+    static void* name##_consume(void* unused) { \
+        (void) unused; \
+        struct Results* results = &name##_results; \
+        while (results->received < name##_items) { \
+            struct Item item, peeked = { 0, { 0, 0, 0 } }; \
+            if (name##_count(&name##_ring) > (size)) { \
+                results->too_full++; \
+            } \
+            int have = (results->received & 1) ? \
+                name##_peek(&name##_ring, &peeked) : 1; \
+            if (!have || !name##_pop(&name##_ring, &item)) { \
+                sched_yield(); \
+                continue; \
+            } \
+            if ((results->received & 1) && peeked.sequence != item.sequence) { \
+                results->out_of_order++; \
+            } \
+            if (!item_good(&item)) { \
+                results->torn++; \
+            } \
+            if (item.sequence != results->received) { \
+                results->out_of_order++; \
+            } \
+            results->received++; \
+        } \
+        return 0; \
+    } \
+    static int name##_run(unsigned int items) { \
+        pthread_t producer, consumer; \
+        name##_items = items; \
+        pthread_create(&consumer, 0, name##_consume, 0); \
+        pthread_create(&producer, 0, name##_produce, 0); \
+        pthread_join(producer, 0); \
+        pthread_join(consumer, 0); \
+        return report(#name, size, items, &name##_results, name##_count(&name##_ring)); \
+    }
+
+/* print what happened to one ring, returns 1 if it went wrong */
+static int report(const char* name, int size, unsigned int items,
+        const struct Results* results, unsigned int left) {
+    int failed = results->received != items || results->torn || results->out_of_order ||
+        results->too_full || left != 0;
+    printf("%-16s size %2d: %u of %u items, %u torn, %u out of order, %u over full, "
+            "%u left  %s\n", name, size, results->received, items, results->torn,
+            results->out_of_order, results->too_full, left, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+RING_TEST(TinyRing, 2)
+RING_TEST(InputSizedRing, 16)
+
+int main(int argc, char** argv) {
+    unsigned int items = argc > 1 ? strtoul(argv[1], 0, 0) : 2000000;
+
+    int failures = TinyRing_run(items) + InputSizedRing_run(items);
+    if (failures) {
+        fprintf(stderr, "ringtest: %d rings failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
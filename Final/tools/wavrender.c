@@ -0,0 +1,154 @@
+/*
+ * wavrender.c
+ * host program which runs the game's mixer from mixer.h a frame at a time
+ * and writes what comes out to a WAV file, so the sound effects and the
+ * mixing can be listened to and looked at without an emulator
+ *
+ * usage: wavrender out.wav [jump|crash|square|chord|all]
+ *
+ * build it from Final/tools so it picks up the game's headers:
+ * gcc -O2 -I.. wavrender.c -o wavrender
+ *
+ * jump, crash and square play one effect the way the game does, chord plays
+ * 8 looping squares at once like sound_benchmark to push the clipping, and
+ * all (the default) plays the lot one after the other
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mixer.h"
+
+/* half a second of quiet between sounds, in frames */
+#define GAP_FRAMES 30
+
+/* how long the looping sounds are held for, in frames */
+#define LOOP_FRAMES 60
+
+struct SoundChannel channels[MIXER_CHANNELS];
+int mix[SOUND_BUFFER_SIZE];
+
+signed char jump[SOUND_JUMP_LENGTH];
+signed char crash[SOUND_CRASH_LENGTH];
+signed char square[SOUND_SQUARE_LENGTH];
+
+/* how many samples have been written and how many hit the 8 bit limits */
+unsigned int samples = 0;
+unsigned int clipped = 0;
+
+/* write value as a little endian number bytes long */
+static void put(FILE* file, unsigned int value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc((value >> (i * 8)) & 0xff, file);
+    }
+}
+
+/* the header of an 8 bit mono WAV file holding count samples */
+static void write_header(FILE* file, unsigned int count) {
+    fwrite("RIFF", 1, 4, file);
+    put(file, 36 + count, 4);
+    fwrite("WAVEfmt ", 1, 8, file);
+    put(file, 16, 4);
+    put(file, 1, 2);            /* PCM */
+    put(file, 1, 2);            /* mono */
+    put(file, SOUND_RATE, 4);
+    put(file, SOUND_RATE, 4);   /* bytes per second */
+    put(file, 1, 2);            /* bytes per sample */
+    put(file, 8, 2);            /* bits per sample */
+    fwrite("data", 1, 4, file);
+    put(file, count, 4);
+}
+
+/* mix frames frames and write them, WAV's 8 bit samples are unsigned */
+static void render(FILE* file, int frames) {
+    signed char out[SOUND_BUFFER_SIZE];
+    for (int f = 0; f < frames; f++) {
+        mixer_mix(channels, mix, out);
+        for (int i = 0; i < SOUND_BUFFER_SIZE; i++) {
+            if (out[i] == 127 || out[i] == -128) {
+                clipped++;
+            }
+            fputc(out[i] + 128, file);
+        }
+        samples += SOUND_BUFFER_SIZE;
+    }
+}
+
+/* whether any channel is still playing */
+static int playing() {
+    for (int i = 0; i < MIXER_CHANNELS; i++) {
+        if (channels[i].data) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* mix until everything has stopped, then leave a gap */
+static void render_until_quiet(FILE* file) {
+    while (playing()) {
+        render(file, 1);
+    }
+    render(file, GAP_FRAMES);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: wavrender out.wav [jump|crash|square|chord|all]\n");
+        return 1;
+    }
+    const char* which = argc > 2 ? argv[2] : "all";
+    int all = strcmp(which, "all") == 0;
+    if (!all && strcmp(which, "jump") && strcmp(which, "crash") &&
+            strcmp(which, "square") && strcmp(which, "chord")) {
+        fprintf(stderr, "wavrender: no sound called %s\n", which);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "wb");
+    if (!file) {
+        fprintf(stderr, "wavrender: can't write %s\n", argv[1]);
+        return 1;
+    }
+
+    mixer_make_effects(jump, crash, square);
+
+    /* the size isn't known yet, the header is written again at the end */
+    write_header(file, 0);
+    render(file, GAP_FRAMES);
+
+    /* the effects at the pitch and volume koopa_jump and the crash use */
+    if (all || strcmp(which, "jump") == 0) {
+        mixer_start(channels, jump, SOUND_JUMP_LENGTH, 4096, 48, 0);
+        render_until_quiet(file);
+    }
+    if (all || strcmp(which, "crash") == 0) {
+        mixer_start(channels, crash, SOUND_CRASH_LENGTH, 4096, 64, 0);
+        render_until_quiet(file);
+    }
+    if (all || strcmp(which, "square") == 0) {
+        mixer_start(channels, square, SOUND_SQUARE_LENGTH, 4096, 32, 1);
+        render(file, LOOP_FRAMES);
+        memset(channels, 0, sizeof(channels));
+        render(file, GAP_FRAMES);
+    }
+    if (all || strcmp(which, "chord") == 0) {
+        for (int i = 0; i < MIXER_CHANNELS; i++) {
+            mixer_start(channels, square, SOUND_SQUARE_LENGTH, 4096 + i * 512, 64, 1);
+        }
+        render(file, LOOP_FRAMES);
+        memset(channels, 0, sizeof(channels));
+        render(file, GAP_FRAMES);
+    }
+
+    fseek(file, 0, SEEK_SET);
+    write_header(file, samples);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "wavrender: couldn't finish writing %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(stderr, "%s: %u samples, %.2f seconds, %u clipped\n", argv[1], samples,
+            (double) samples / SOUND_RATE, clipped);
+    return 0;
+}
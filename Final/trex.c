@@ -6,16 +6,99 @@
 #define SCREEN_WIDTH 240
 #define SCREEN_HEIGHT 160
 
-/* include the background image we are using */
-#include "background.h"
+/* the ids and sizes of the assets packed into assets.bin, the background is
+ * background.h after going through tools/gba4bpp so it's 4bpp with 16 color
+ * palette banks */
+#include "assets.h"
 
 /* include the sprite image we are using */
 #include "koopa.h"
 #include "evilkoopa.h"
 
-/* include the tile map we are using */
-#include "mapBack.h"
-#include "map2.h"
+/* the jump arcs made by tools/jumpgen, see struct JumpArc */
+#include "jumps.h"
+
+/* the xorshift and PCG random numbers, shared with tools/hostbench */
+#include "random.h"
+
+/* the actor scripts, see struct Script, also shared with tools/hostbench */
+#include "script.h"
+
+/* looking tiles up in the maps, also shared with tools/hostbench */
+#include "tile.h"
+
+/* the lock free rings used to pass things to and from interrupt handlers,
+ * tools/ringtest hammers the same code with threads on the host */
+#include "ring.h"
+
+/* the sprites can be converted the same way with tools/gba4bpp -s koopa.h
+ * into koopa4.h and then built with SPRITES_4BPP defined */
+#ifdef SPRITES_4BPP
+#include "koopa4.h"
+#define SPRITE_COLOR_MODE 0
+#define SPRITE_FRAME_TILES 8
+#else
+#define SPRITE_COLOR_MODE 1
+#define SPRITE_FRAME_TILES 16
+#endif
+
+/* the asset pack made by tools/assetpack, which assets.s links into ROM */
+extern const unsigned char assets[];
+
+/* the kinds of assets in the pack */
+enum AssetType {
+    ASSET_DATA,
+    ASSET_TILES,
+    ASSET_PALETTE,
+    ASSET_MAP
+};
+
+/* one entry in the pack's table of contents */
+struct AssetEntry {
+    unsigned short id;
+    unsigned char type;
+    unsigned char compression;
+    unsigned int offset;
+    unsigned int size;
+    unsigned int alignment;
+};
+
+/* the pack starts with this header and then the table of contents */
+struct AssetPack {
+    char magic[4];
+    unsigned short version;
+    unsigned short count;
+    struct AssetEntry entries[];
+};
+
+/* find an asset in the pack, returns 0 if it isn't there
+ * the ids are the places in the table so this is just an index */
+const void* asset_find(int id, unsigned int* size) {
+    const struct AssetPack* pack = (const struct AssetPack*) assets;
+    if (id < 0 || id >= pack->count || pack->entries[id].id != id) {
+        return 0;
+    }
+    if (size) {
+        *size = pack->entries[id].size;
+    }
+    return assets + pack->entries[id].offset;
+}
+
+/* the background image, its palette banks and the tile maps we are using */
+const unsigned char* background_4bpp_data;
+const unsigned short* background_4bpp_palette;
+const unsigned char* background_tile_bank;
+const unsigned short* mapBack;
+const unsigned short* map2;
+
+/* look up where all the assets are */
+void assets_init() {
+    background_4bpp_data = asset_find(ASSET_BACKGROUND_4BPP_DATA, 0);
+    background_4bpp_palette = asset_find(ASSET_BACKGROUND_4BPP_PALETTE, 0);
+    background_tile_bank = asset_find(ASSET_BACKGROUND_TILE_BANK, 0);
+    mapBack = asset_find(ASSET_MAPBACK, 0);
+    map2 = asset_find(ASSET_MAP2, 0);
+}
 
 /* the tile mode flags needed for display control register */
 #define MODE0 0x00
@@ -38,6 +121,10 @@ volatile unsigned short* bg1_control = (volatile unsigned short*) 0x400000a;
 volatile unsigned short* bg2_control = (volatile unsigned short*) 0x400000c;
 volatile unsigned short* bg3_control = (volatile unsigned short*) 0x400000e;
 
+/* functions marked as iwram code are put in the fast 32 bit internal ram and
+ * compiled as ARM code, which is the fastest way to run a hot loop */
+#define IWRAM_CODE __attribute__((section(".iwram"), long_call, target("arm")))
+
 /* palette is always 256 colors */
 #define PALETTE_SIZE 256
 
@@ -67,6 +154,8 @@ volatile short* bg0_x_scroll = (unsigned short*) 0x4000010;
 volatile short* bg0_y_scroll = (unsigned short*) 0x4000012;
 volatile short* bg1_x_scroll = (unsigned short*) 0x4000014;
 volatile short* bg1_y_scroll = (unsigned short*) 0x4000016;
+volatile short* bg2_x_scroll = (unsigned short*) 0x4000018;
+volatile short* bg2_y_scroll = (unsigned short*) 0x400001a;
 
 /* the bit positions indicate each button - the first bit is for A, second for
  * B, and so on, each constant below can be ANDED into the register to get the
@@ -86,16 +175,137 @@ volatile short* bg1_y_scroll = (unsigned short*) 0x4000016;
  * much of the screen has been drawn */
 volatile unsigned short* scanline_counter = (volatile unsigned short*) 0x4000006;
 
-/* wait for the screen to be fully drawn so we can do something during vblank */
+/* counts up once every vblank interrupt, a frame is 280896 cycles of the
+ * 16.78 MHz clock so that's about 59.73 times a second, not quite 60 */
+volatile unsigned int vblank_count = 0;
+
+/* counters for the fixed timestep loop, these should always add up so that
+ * clock only ever moves with vblank_count */
+struct Timing {
+    /* the vblank the game logic has caught up to */
+    unsigned int clock;
+
+    /* logic ticks which have been run */
+    unsigned int ticks;
+
+    /* frames which were committed to the screen */
+    unsigned int frames;
+
+    /* vblanks which were missed because the logic ran long */
+    unsigned int skipped;
+
+    /* ticks thrown away because the logic fell too far behind */
+    unsigned int dropped;
+};
+struct Timing timing;
+
+/* the most logic ticks to run in one go to catch up */
+#define MAX_CATCHUP_TICKS 4
+
+/* call a BIOS function, the number goes in a different place in the
+ * instruction in thumb code and ARM code */
+#ifdef __thumb__
+#define BIOS_CALL(n) __asm__ volatile ("swi " #n ::: "r0", "r1", "r2", "r3", "memory")
+#else
+#define BIOS_CALL(n) __asm__ volatile ("swi " #n " << 16" ::: "r0", "r1", "r2", "r3", "memory")
+#endif
+
+/* stop the cpu until the next enabled interrupt, which saves a lot of power
+ * compared to spinning in a loop, interrupts have to be on */
+#define halt() BIOS_CALL(0x02)
+
+/* turn almost everything off until a key, serial or cartridge interrupt,
+ * the display has to be blanked and the sound turned off first */
+#define stop() BIOS_CALL(0x03)
+
+/* wait for the next vblank interrupt so we can do something during vblank */
 void wait_vblank( ) {
-    /* wait until all 160 lines have been updated */
-    while (*scanline_counter < 160) { }
+    unsigned int start = vblank_count;
+    while (vblank_count == start) {
+        halt();
+    }
+}
+
+/* a change to the buttons, seen by the vblank interrupt */
+struct InputEvent {
+    /* the button register after the change, a 0 bit is held down */
+    unsigned short keys;
+
+    /* the vblank it was seen on */
+    unsigned int vblank;
+};
+#define INPUT_RING_SIZE 16
+RING_DEFINE(InputRing, struct InputEvent, INPUT_RING_SIZE)
+struct InputRing input_events;
+
+/* button changes made up by the main loop, like a replay or the latency
+ * test, they get their own ring since the vblank interrupt is the one and
+ * only producer for input_events */
+struct InputRing input_replay;
+
+/* the buttons as the game logic sees them, and as the interrupt last saw
+ * them, both start with nothing held */
+unsigned short input_keys = 0x3ff;
+unsigned short input_sampled = 0x3ff;
+
+/* look at the buttons from the vblank interrupt and pass on any change, if
+ * the ring is full it's tried again next vblank so it can't get out of step */
+void input_sample() {
+    unsigned short keys = *buttons & 0x3ff;
+    if (keys != input_sampled) {
+        struct InputEvent event = { keys, vblank_count };
+        if (InputRing_push(&input_events, &event)) {
+            input_sampled = keys;
+        }
+    }
+}
+
+/* buttons which have gone down since button_hit last looked at them */
+unsigned short input_hits = 0;
+
+/* apply the button changes from up to and including vblank upto, from
+ * both rings in the order they happened */
+void input_poll(unsigned int upto) {
+    struct InputEvent event, replay;
+    while (1) {
+        int have_event = InputRing_peek(&input_events, &event) &&
+            (int) (event.vblank - upto) <= 0;
+        int have_replay = InputRing_peek(&input_replay, &replay) &&
+            (int) (replay.vblank - upto) <= 0;
+        if (!have_event && !have_replay) {
+            break;
+        }
+
+        /* the real buttons go first if they changed on the same vblank */
+        if (have_replay && (!have_event || (int) (replay.vblank - event.vblank) < 0)) {
+            InputRing_pop(&input_replay, &event);
+        } else {
+            InputRing_pop(&input_events, &event);
+        }
+        input_hits |= input_keys & ~event.keys;
+        input_keys = event.keys;
+    }
+}
+
+/* apply every button change so far and forget any presses, so nothing from
+ * before a pause or a restart carries over */
+void input_flush() {
+    input_poll(vblank_count);
+    input_hits = 0;
+}
+
+/* returns whether a button went down since the last time this was asked,
+ * which is what's wanted for something like a pause button */
+int button_hit(unsigned short button) {
+    int hit = (input_hits & button) != 0;
+    input_hits &= ~button;
+    return hit;
 }
 
 /* this function checks whether a particular button has been pressed */
 unsigned char button_pressed(unsigned short button) {
-    /* and the button register with the button constant we want */
-    unsigned short pressed = *buttons & button;
+    /* and the buttons with the button constant we want */
+    unsigned short pressed = input_keys & button;
 
     /* if this value is zero, then it's not pressed */
     if (pressed == 0) {
@@ -140,56 +350,742 @@ void memcpy16_dma(unsigned short* dest, unsigned short* source, int amount) {
     *dma_count = amount | DMA_16 | DMA_ENABLE;
 }
 
-/* function to setup background 0 for this program */
-void setup_background() {
+/* timers 2 and 3 are cascaded into a 32 bit cycle counter for profiling */
+volatile unsigned short* timer2_data = (volatile unsigned short*) 0x4000108;
+volatile unsigned short* timer2_control = (volatile unsigned short*) 0x400010A;
+volatile unsigned short* timer3_data = (volatile unsigned short*) 0x400010C;
+volatile unsigned short* timer3_control = (volatile unsigned short*) 0x400010E;
+
+/* flags for the timer control registers */
+#define TIMER_ENABLE 0x80
+#define TIMER_IRQ 0x40
+#define TIMER_CASCADE 0x04
+
+/* the things the profiler keeps a cycle count for, these can be read out
+ * of profile_cycles with an emulator's memory viewer */
+enum ProfileSlot {
+    PROFILE_AFFINE_COLD,    /* 32 sprites each needing a new matrix */
+    PROFILE_AFFINE_WARM,    /* 32 sprites sharing one cached matrix */
+    PROFILE_MIXER,          /* the sound mixer, measured every frame */
+    PROFILE_MIXER_4,        /* the sound mixer with 4 channels playing */
+    PROFILE_MIXER_8,        /* the sound mixer with 8 channels playing */
+    PROFILE_SCRIPTS_100,    /* one frame of 100 actor scripts */
+    PROFILE_XORSHIFT_256,   /* 256 xorshift32 random numbers */
+    PROFILE_PCG_256,        /* 256 PCG32 random numbers */
+    PROFILE_TILE_LOOKUP_DEFAULT,    /* 1000 tile_lookups, power-on wait states */
+    PROFILE_TILE_LOOKUP_3_1,        /* 1000 tile_lookups, 3/1 wait states */
+    PROFILE_TILE_LOOKUP_PREFETCH,   /* 1000 tile_lookups, 3/1 and prefetch */
+    PROFILE_ROM_COPY_DEFAULT,       /* 8K copied from ROM, power-on wait states */
+    PROFILE_ROM_COPY_3_1,           /* 8K copied from ROM, 3/1 wait states */
+    PROFILE_ROM_COPY_PREFETCH,      /* 8K copied from ROM, 3/1 and prefetch */
+    PROFILE_BOX_SCALAR,     /* 100 16x32 boxes checked with tile_lookup */
+    PROFILE_BOX_BATCHED,    /* 100 16x32 boxes checked with tile_query_box */
+    PROFILE_IRQ_LATENCY,    /* from a timer overflowing to its handler running */
+    PROFILE_RUN_AHEAD,      /* the extra tick run ahead, measured every frame */
+    PROFILE_COUNT
+};
+unsigned int profile_cycles[PROFILE_COUNT];
+
+/* reset the cycle counter and start it running */
+void profile_start() {
+    *timer2_control = 0;
+    *timer3_control = 0;
+    *timer2_data = 0;
+    *timer3_data = 0;
+    *timer3_control = TIMER_ENABLE | TIMER_CASCADE;
+    *timer2_control = TIMER_ENABLE;
+}
+
+/* stop the cycle counter and return how many cycles went by */
+unsigned int profile_stop() {
+    *timer2_control = 0;
+    return (*timer3_data << 16) | *timer2_data;
+}
+
+/* the game pak wait state control register sets how many cycles each ROM
+ * access takes, and whether the prefetch buffer reads ahead */
+volatile unsigned short* wait_control = (volatile unsigned short*) 0x4000204;
+
+/* the power-on setting: 4 cycles for the first ROM access, 2 for the rest */
+#define WAITCNT_DEFAULT 0x0000
+
+/* 3 cycles for the first ROM access and 1 for the rest, 8 for SRAM */
+#define WAITCNT_3_1 0x0017
+
+/* the same but with the prefetch buffer on, which is the fastest setting
+ * every cartridge supports */
+#define WAITCNT_FAST 0x4017
+
+/* which setting to use, build with ROM_WAIT_DEFAULT to leave the power-on
+ * wait states alone */
+#ifdef ROM_WAIT_DEFAULT
+#define WAITCNT_STARTUP WAITCNT_DEFAULT
+#else
+#define WAITCNT_STARTUP WAITCNT_FAST
+#endif
+
+/* set the ROM wait states, this should be the first thing main does */
+void waitstate_init() {
+    *wait_control = WAITCNT_STARTUP;
+}
+
+/* memory is handed out from arenas, which just bump a pointer along a block
+ * of memory and are all freed at once by resetting them */
+struct Arena {
+    unsigned char* base;
+    unsigned int size;
+
+    /* bytes in use now, and the most that have ever been in use */
+    unsigned int used;
+    unsigned int peak;
+};
+
+/* the level arena is reset every time a new run starts, and the game arena
+ * holds things made once at startup and is never reset
+ * their memory is in the external work ram, put there by the linker in
+ * .sbss so it can't overlap anything else it places there, and unlike
+ * .ewram it isn't copied from ROM at startup so the zeros take no ROM */
+#define LEVEL_ARENA_SIZE 0x10000
+#define GAME_ARENA_SIZE 0x4000
+unsigned char ewram_level[LEVEL_ARENA_SIZE] __attribute__((section(".sbss"), aligned(4)));
+unsigned char ewram_game[GAME_ARENA_SIZE] __attribute__((section(".sbss"), aligned(4)));
+struct Arena level_arena;
+struct Arena game_arena;
+
+/* a small scratch arena in the fast internal ram for data which is only
+ * needed for part of a frame, it's reset every frame */
+#define SCRATCH_SIZE 2048
+unsigned char iwram_scratch[SCRATCH_SIZE] __attribute__((aligned(4)));
+struct Arena scratch_arena;
+
+/* set up an arena over a block of memory */
+void arena_init(struct Arena* arena, void* base, unsigned int size) {
+    arena->base = (unsigned char*) base;
+    arena->size = size;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+/* get some memory from an arena, word aligned, or 0 if it's full */
+void* arena_alloc(struct Arena* arena, unsigned int size) {
+    size = (size + 3) & ~3;
+    if (arena->used + size > arena->size) {
+        return 0;
+    }
+    void* memory = arena->base + arena->used;
+    arena->used += size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    return memory;
+}
+
+/* free everything in an arena at once */
+void arena_reset(struct Arena* arena) {
+    arena->used = 0;
+}
+
+/* a pool hands out fixed size objects, freed ones go on a list threaded
+ * through the objects themselves so alloc and free are O(1) */
+struct Pool {
+    void* free;
+    unsigned int object_size;
+
+    /* objects in use now, and the most that have ever been in use */
+    int in_use;
+    int peak;
+};
+
+/* carve a pool of count objects out of an arena, returns 0 if it didn't fit */
+int pool_init(struct Pool* pool, struct Arena* arena, unsigned int object_size, int count) {
+    object_size = (object_size + 3) & ~3;
+    unsigned char* memory = arena_alloc(arena, object_size * count);
+    pool->free = 0;
+    pool->object_size = object_size;
+    pool->in_use = 0;
+    pool->peak = 0;
+    if (!memory) {
+        return 0;
+    }
+
+    /* link them all onto the free list */
+    for (int i = count - 1; i >= 0; i--) {
+        void** object = (void**) (memory + i * object_size);
+        *object = pool->free;
+        pool->free = object;
+    }
+    return 1;
+}
+
+/* get an object from a pool, or 0 if they're all in use */
+void* pool_alloc(struct Pool* pool) {
+    void** object = pool->free;
+    if (object) {
+        pool->free = *object;
+        if (++pool->in_use > pool->peak) {
+            pool->peak = pool->in_use;
+        }
+    }
+    return object;
+}
+
+/* give an object back to its pool */
+void pool_free(struct Pool* pool, void* object) {
+    *(void**) object = pool->free;
+    pool->free = object;
+    pool->in_use--;
+}
+
+/* the game's actors come out of this pool, which lives in the level arena,
+ * each object is big enough for any of the actor structs */
+#define MAX_ENTITIES 16
+#define ENTITY_SIZE 96
+struct Pool entity_pool;
+
+/* set up the arenas that last the whole game */
+void memory_init() {
+    arena_init(&level_arena, ewram_level, LEVEL_ARENA_SIZE);
+    arena_init(&game_arena, ewram_game, GAME_ARENA_SIZE);
+    arena_init(&scratch_arena, iwram_scratch, SCRATCH_SIZE);
+}
+
+/* throw away everything from the last run and set up the entity pool again */
+void memory_new_level() {
+    arena_reset(&level_arena);
+    pool_init(&entity_pool, &level_arena, ENTITY_SIZE, MAX_ENTITIES);
+}
+
+/* memory use, which can be read out with an emulator's memory viewer, or
+ * seen along the bottom of the HUD in a build with MEMORY_OVERLAY defined */
+struct MemoryStats {
+    unsigned int level_used, level_peak;
+    unsigned int game_used, game_peak;
+    unsigned int scratch_peak;
+    int entities, entities_peak;
+};
+struct MemoryStats memory_stats;
+
+/* copy the arena numbers into the stats */
+void memory_update_stats() {
+    memory_stats.level_used = level_arena.used;
+    memory_stats.level_peak = level_arena.peak;
+    memory_stats.game_used = game_arena.used;
+    memory_stats.game_peak = game_arena.peak;
+    memory_stats.scratch_peak = scratch_arena.peak;
+    memory_stats.entities = entity_pool.in_use;
+    memory_stats.entities_peak = entity_pool.peak;
+}
+
+/* the blending registers, used to fade the whole screen in hardware */
+volatile unsigned short* blend_control = (volatile unsigned short*) 0x4000050;
+volatile unsigned short* blend_alpha = (volatile unsigned short*) 0x4000052;
+volatile unsigned short* blend_brightness = (volatile unsigned short*) 0x4000054;
+
+/* blend control value which darkens all layers, sprites and the backdrop */
+#define BLEND_DARKEN_ALL 0x00ff
+
+/* the palettes as loaded (backgrounds then sprites), and the shadow copy
+ * with all the effects applied which is copied to palette memory in vblank */
+unsigned short palette_source[PALETTE_SIZE * 2];
+unsigned short palette_shadow[PALETTE_SIZE * 2];
+int palette_dirty = 0;
+
+/* the fade towards black, 0 is normal and 16 << 8 is fully black */
+int fade_level = 0;
+int fade_target = 0;
+int fade_speed = 0;
+
+/* fades use the brightness registers so they cost no cpu, unless this is
+ * cleared because something else needs the blending hardware */
+int fade_hardware = 1;
+
+/* the flash blends the sprite palette towards a color, 32 << 8 is full */
+unsigned short flash_color = 0;
+int flash_amount = 0;
+int flash_speed = 0;
+
+/* a 15 bit color spread out so red, blue and green each have 5 spare bits
+ * above them, then each can be multiplied by up to 32 at the same time */
+#define SWAR_MASK 0x03e07c1f
+
+/* blend count colors from source towards color by amount/32 into dest
+ * using one multiply per color for all three channels */
+void palette_blend(unsigned short* dest, const unsigned short* source, int count,
+        unsigned short color, int amount) {
+    unsigned int c = ((color | (color << 16)) & SWAR_MASK) * amount;
+    int keep = 32 - amount;
+    for (int i = 0; i < count; i++) {
+        unsigned int x = source[i];
+        x = (((x | (x << 16)) & SWAR_MASK) * keep + c) >> 5;
+        x &= SWAR_MASK;
+        dest[i] = (x | (x >> 16)) & 0x7fff;
+    }
+}
+
+/* copy the source palette into the shadow with the flash applied */
+void palette_rebuild() {
+    for (int i = 0; i < PALETTE_SIZE * 2; i++) {
+        palette_shadow[i] = palette_source[i];
+    }
+
+    /* flash the sprites */
+    if (flash_amount > 0) {
+        palette_blend(palette_shadow + PALETTE_SIZE, palette_shadow + PALETTE_SIZE,
+                PALETTE_SIZE, flash_color, flash_amount >> 8);
+    }
+
+    /* the software version of the fade */
+    if (!fade_hardware && fade_level > 0) {
+        palette_blend(palette_shadow, palette_shadow, PALETTE_SIZE * 2, 0, fade_level >> 7);
+    }
+    palette_dirty = 1;
+}
+
+/* fade to a brightness level (0 is normal, 16 is black) over some frames */
+void palette_fade(int level, int frames) {
+    fade_target = level << 8;
+    if (frames <= 0) {
+        fade_level = fade_target;
+        fade_speed = 0;
+    } else {
+        fade_speed = ((16 << 8) + frames - 1) / frames;
+    }
+    palette_dirty = 1;
+}
+
+/* flash the sprites towards a color then fade back over some frames */
+void palette_flash(unsigned short color, int frames) {
+    flash_color = color;
+    if (frames <= 0) {
+        flash_amount = 0;
+        flash_speed = 0;
+    } else {
+        flash_amount = 32 << 8;
+        flash_speed = ((32 << 8) + frames - 1) / frames;
+    }
+}
+
+/* returns whether a fade or flash is still going */
+int palette_busy() {
+    return fade_level != fade_target || flash_amount > 0;
+}
+
+/* step all of the effects forward one frame */
+void palette_update() {
+    int changed = 0;
+
+    if (fade_level < fade_target) {
+        fade_level += fade_speed;
+        if (fade_level > fade_target) {
+            fade_level = fade_target;
+        }
+        changed = !fade_hardware;
+    } else if (fade_level > fade_target) {
+        fade_level -= fade_speed;
+        if (fade_level < fade_target) {
+            fade_level = fade_target;
+        }
+        changed = !fade_hardware;
+    }
+
+    if (flash_amount > 0) {
+        flash_amount -= flash_speed;
+        if (flash_amount < 0) {
+            flash_amount = 0;
+        }
+        changed = 1;
+    }
+
+    if (changed) {
+        palette_rebuild();
+    }
+}
+
+/* copy the shadow palette and the fade level to the hardware, call in vblank */
+void palette_commit() {
+    if (fade_hardware) {
+        *blend_control = BLEND_DARKEN_ALL;
+        *blend_brightness = fade_level >> 8;
+    } else {
+        *blend_control = 0;
+    }
+
+    if (palette_dirty) {
+        memcpy16_dma((unsigned short*) bg_palette, palette_shadow, PALETTE_SIZE * 2);
+        palette_dirty = 0;
+    }
+}
+
+/* the interrupt registers */
+volatile unsigned short* display_status = (volatile unsigned short*) 0x4000004;
+volatile unsigned short* interrupt_enable = (volatile unsigned short*) 0x4000200;
+volatile unsigned short* interrupt_flags = (volatile unsigned short*) 0x4000202;
+volatile unsigned short* interrupt_master = (volatile unsigned short*) 0x4000208;
+
+/* interrupt bits for the enable and flag registers */
+#define INT_VBLANK (1 << 0)
+#define INT_TIMER0 (1 << 3)
+#define INT_TIMER1 (1 << 4)
+#define INT_TIMER2 (1 << 5)
+#define INT_KEYPAD (1 << 12)
+#define NUM_INTERRUPTS 14
+
+/* an interrupt handler, called from interrupt_master_isr in interrupt.s */
+typedef void (*intrp)( );
+
+/* the handler for each interrupt bit, 0 for none */
+intrp interrupt_handlers[NUM_INTERRUPTS];
+
+/* interrupts which are let in while any other handler is running, the audio
+ * timer shouldn't have to wait for a long vblank handler to finish */
+unsigned short interrupt_preempt_mask = INT_TIMER0;
+
+/* the BIOS jumps to the function this points to on an interrupt */
+#define INTERRUPT_VECTOR (*(intrp*) 0x03007FFC)
+void interrupt_master_isr( );
+void interrupt_vblank( );
+void interrupt_ignore( );
+
+/* install the master handler with nothing enabled yet */
+void interrupt_init() {
+    *interrupt_master = 0;
+    *interrupt_enable = 0;
+    *interrupt_flags = 0xffff;
+    for (int i = 0; i < NUM_INTERRUPTS; i++) {
+        interrupt_handlers[i] = 0;
+    }
+    INTERRUPT_VECTOR = interrupt_master_isr;
+}
+
+/* set the handler for each of the interrupt bits in irq and enable them, or
+ * disable them if the handler is 0
+ * handlers shouldn't change the enable register themselves since the master
+ * handler puts it back when they return */
+void interrupt_set(unsigned short irq, intrp handler) {
+    unsigned short master = *interrupt_master;
+    *interrupt_master = 0;
+    for (int i = 0; i < NUM_INTERRUPTS; i++) {
+        if (irq & (1 << i)) {
+            interrupt_handlers[i] = handler;
+        }
+    }
+    if (handler) {
+        *interrupt_enable |= irq;
+    } else {
+        *interrupt_enable &= ~irq;
+    }
+    *interrupt_master = master;
+}
+
+#ifdef BENCHMARKS
+/* the timer count the latency handler saw, and whether it has run */
+volatile unsigned short interrupt_latency_count;
+volatile int interrupt_latency_done;
+
+/* reads the timer as early as it can, then stops it */
+void interrupt_latency_handler( ) {
+    interrupt_latency_count = *timer2_data;
+    *timer2_control = 0;
+    interrupt_latency_done = 1;
+}
+
+/* time from timer 2 overflowing to its handler running, the timer reloads
+ * and keeps counting cycles after the overflow so the count it has in the
+ * handler is the latency through the BIOS and the master handler */
+#define LATENCY_RELOAD (65536 - 256)
+void interrupt_benchmark() {
+    interrupt_latency_done = 0;
+    interrupt_set(INT_TIMER2, interrupt_latency_handler);
+    *timer2_control = 0;
+    *timer2_data = LATENCY_RELOAD;
+    *timer2_control = TIMER_ENABLE | TIMER_IRQ;
+    while (!interrupt_latency_done) { }
+    interrupt_set(INT_TIMER2, 0);
+    profile_cycles[PROFILE_IRQ_LATENCY] = interrupt_latency_count - LATENCY_RELOAD;
+}
+#endif
+
+/* the bit in the display status register which asks for vblank interrupts */
+#define DISPSTAT_VBLANK_IRQ 0x08
+
+/* the sound control registers */
+volatile unsigned short* sound_control = (volatile unsigned short*) 0x4000082;
+volatile unsigned short* sound_master = (volatile unsigned short*) 0x4000084;
+
+/* the direct sound A fifo which the samples are fed into */
+#define FIFO_A 0x40000A0
+
+/* timer 0 sets the sample rate of direct sound A */
+volatile unsigned short* timer0_data = (volatile unsigned short*) 0x4000100;
+volatile unsigned short* timer0_control = (volatile unsigned short*) 0x4000102;
+
+/* DMA channel 1 refills the fifo each time timer 0 overflows */
+volatile unsigned int* dma1_source = (volatile unsigned int*) 0x40000BC;
+volatile unsigned int* dma1_destination = (volatile unsigned int*) 0x40000C0;
+volatile unsigned int* dma1_control = (volatile unsigned int*) 0x40000C4;
+
+/* the extra DMA flags needed to feed the sound fifo */
+#define DMA_DEST_FIXED 0x00400000
+#define DMA_REPEAT 0x02000000
+#define DMA_SPECIAL 0x30000000
+
+/* flags for the sound control registers */
+#define SOUND_MASTER_ENABLE 0x80
+#define SOUND_A_FULL_VOLUME 0x04
+#define SOUND_A_RIGHT 0x100
+#define SOUND_A_LEFT 0x200
+#define SOUND_A_RESET_FIFO 0x800
+
+/* the mixer itself and the sound effects, shared with tools/wavrender, the
+ * mixer runs every frame so it goes in IWRAM */
+#define MIXER_CODE IWRAM_CODE
+#include "mixer.h"
+
+/* the two halves of the buffer, DMA plays one while the mixer fills the other */
+signed char sound_buffer[SOUND_BUFFER_SIZE * 2] __attribute__((aligned(4)));
+
+/* which half is playing right now */
+volatile int sound_active = 0;
+
+/* set each vblank when the half which isn't playing needs to be mixed */
+volatile int sound_need_mix = 0;
+
+/* the sounds which are playing */
+struct SoundChannel sound_channels[MIXER_CHANNELS];
+
+/* samples are added up here before being clipped down to 8 bits */
+int sound_mix_buffer[SOUND_BUFFER_SIZE];
+
+/* the sound effects, made when the sound starts up, the longer ones come
+ * out of the game arena since they last the whole game */
+signed char* sound_jump;
+signed char* sound_crash;
+signed char sound_square[SOUND_SQUARE_LENGTH];
+
+/* point DMA 1 at the start of the buffer and start feeding the fifo */
+void sound_restart_dma() {
+    *dma1_control = 0;
+    *dma1_source = (unsigned int) sound_buffer;
+    *dma1_destination = FIFO_A;
+    *dma1_control = DMA_DEST_FIXED | DMA_REPEAT | DMA_32 | DMA_SPECIAL | DMA_ENABLE;
+}
+
+/* turn on direct sound A driven by timer 0 */
+void sound_init() {
+    sound_jump = arena_alloc(&game_arena, SOUND_JUMP_LENGTH);
+    sound_crash = arena_alloc(&game_arena, SOUND_CRASH_LENGTH);
+    mixer_make_effects(sound_jump, sound_crash, sound_square);
+
+    for (int i = 0; i < MIXER_CHANNELS; i++) {
+        sound_channels[i].data = 0;
+    }
+    for (int i = 0; i < SOUND_BUFFER_SIZE * 2; i++) {
+        sound_buffer[i] = 0;
+    }
+
+    *sound_master = SOUND_MASTER_ENABLE;
+    *sound_control = SOUND_A_FULL_VOLUME | SOUND_A_RIGHT | SOUND_A_LEFT | SOUND_A_RESET_FIFO;
+
+    sound_active = 0;
+    sound_restart_dma();
+
+    *timer0_data = 65536 - SOUND_TIMER_PERIOD;
+    *timer0_control = TIMER_ENABLE;
+}
+
+/* called at the start of each vblank, right as DMA finishes one half */
+void sound_vblank() {
+    if (sound_active == 1) {
+        /* the second half just finished so go back to the first */
+        sound_restart_dma();
+        sound_active = 0;
+    } else {
+        sound_active = 1;
+    }
+    sound_need_mix = 1;
+}
+
+/* start a sound, step is the pitch where 4096 plays it at 18157 samples per
+ * second, volume goes up to 64, returns the channel it's playing on */
+int sound_play(const signed char* data, int length, int step, int volume, int loop) {
+    return mixer_start(sound_channels, data, length, step, volume, loop);
+}
+
+/* stop the sound on a channel */
+void sound_stop(int channel) {
+    sound_channels[channel].data = 0;
+}
+
+/* a sound for the mixer to start, the game queues these with sound_queue
+ * and sound_update starts them right before it mixes, both are in the main
+ * loop so this is a plain queue and not one of the interrupt rings */
+struct SoundCommand {
+    const signed char* data;
+    int length;
+    int step;
+    int volume;
+    int loop;
+};
+#define SOUND_QUEUE_SIZE 8
+struct SoundCommand sound_commands[SOUND_QUEUE_SIZE];
+int sound_queued = 0;
+
+/* ask for a sound to be played the next time the mixer runs, returns 0 if
+ * too many are waiting already */
+int sound_queue(const signed char* data, int length, int step, int volume, int loop) {
+    if (sound_queued == SOUND_QUEUE_SIZE) {
+        return 0;
+    }
+    struct SoundCommand command = { data, length, step, volume, loop };
+    sound_commands[sound_queued++] = command;
+    return 1;
+}
+
+/* mix every playing channel into the half of the buffer which isn't playing,
+ * this has to run once a frame */
+IWRAM_CODE void sound_mix() {
+    mixer_mix(sound_channels, sound_mix_buffer, sound_buffer + (sound_active ^ 1) * SOUND_BUFFER_SIZE);
+}
+
+/* mix this frame's sound and record how long it took, does nothing if the
+ * sound has already been mixed since the last vblank */
+void sound_update() {
+    for (int i = 0; i < sound_queued; i++) {
+        struct SoundCommand* command = &sound_commands[i];
+        sound_play(command->data, command->length, command->step, command->volume, command->loop);
+    }
+    sound_queued = 0;
+
+    if (!sound_need_mix) {
+        return;
+    }
+    sound_need_mix = 0;
+
+    profile_start();
+    sound_mix();
+    profile_cycles[PROFILE_MIXER] = profile_stop();
+}
+
+#ifdef BENCHMARKS
+/* time the mixer with 4 and then 8 looping sounds playing */
+void sound_benchmark() {
+    for (int i = 0; i < MIXER_CHANNELS; i++) {
+        sound_play(sound_square, SOUND_SQUARE_LENGTH, 4096 + i * 512, 8, 1);
+    }
 
-   
+    sound_channels[4].data = sound_channels[5].data = 0;
+    sound_channels[6].data = sound_channels[7].data = 0;
+    profile_start();
+    sound_mix();
+    profile_cycles[PROFILE_MIXER_4] = profile_stop();
 
-    /* load the palette from the image into palette memory*/
-    for (int i = 0; i < PALETTE_SIZE; i++) {
-        bg_palette[i] = background_palette[i];
+    for (int i = 4; i < MIXER_CHANNELS; i++) {
+        sound_channels[i].data = sound_square;
     }
+    profile_start();
+    sound_mix();
+    profile_cycles[PROFILE_MIXER_8] = profile_stop();
 
-    /* load the image into char block 0 (16 bits at a time) */
-    volatile unsigned short* dest = char_block(0);
-    volatile unsigned short* dest2 = char_block(1);
-    unsigned short* image = (unsigned short*) background_data;
-    for (int i = 0; i < ((background_width * background_height) / 2); i++) {
-        dest[i] = image[i];
-        dest2[i] = image[i];
+    for (int i = 0; i < MIXER_CHANNELS; i++) {
+        sound_stop(i);
     }
+}
+#endif
+
+/* the cooperative scheduler spreads long jobs across frames, each task does
+ * its job a slice at a time and gets a budget of cycles each frame */
+struct Task {
+    /* do one slice of the job, return 1 once the whole job is done */
+    int (*step)(struct Task* task);
+
+    /* how far along the job is, for the step function to use */
+    int position;
+
+    /* the cycles the task may use each frame */
+    unsigned int budget;
+
+    /* the cycles it used in the last frame it ran */
+    unsigned int used;
 
-    /* set all control the bits in this register */
-    *bg0_control = 1 |    /* priority, 0 is highest, 3 is lowest */
-        (0 << 2)  |       /* the char block the image data is stored in */
-        (0 << 6)  |       /* the mosaic flag */
-        (1 << 7)  |       /* color mode, 0 is 16 colors, 1 is 256 colors */
-        (16 << 8) |       /* the screen block the tile data is stored in */
-        (1 << 13) |       /* wrapping flag */
-        (0 << 14);        /* bg size, 0 is 256x256 */
-    /* set all control the bits in this register */
-    *bg1_control = 0 |    /* priority, 0 is highest, 3 is lowest */
-        (0 << 2)  |       /* the char block the image data is stored in */
-        (0 << 6)  |       /* the mosaic flag */
-        (1 << 7)  |       /* color mode, 0 is 16 colors, 1 is 256 colors */
-        (15 << 8) |       /* the screen block the tile data is stored in */
-        (1 << 13) |       /* wrapping flag */
-        (0 << 14);        /* bg size, 0 is 256x256 */
+    /* how many frames it went over its budget */
+    unsigned int overruns;
 
-    /* load the tile data into screen block 16 */
-    dest = screen_block(16);
-    dest2 = screen_block(15);
-    for(int i = 0; i < (mapBack_width* mapBack_height); i++){
-        dest[i] = mapBack[i];
+    /* whether it still has work to do */
+    int active;
+};
+
+/* the most tasks which can be queued at once */
+#define MAX_TASKS 8
+struct Task tasks[MAX_TASKS];
+
+/* timer 1 runs freely at 1/64 of the cpu clock so the scheduler can measure
+ * how long each slice took, one frame is about 4400 timer ticks */
+volatile unsigned short* timer1_data = (volatile unsigned short*) 0x4000104;
+volatile unsigned short* timer1_control = (volatile unsigned short*) 0x4000106;
+#define TIMER_FREQ_64 0x01
+
+/* start the scheduler's timer */
+void scheduler_init() {
+    for (int i = 0; i < MAX_TASKS; i++) {
+        tasks[i].active = 0;
+    }
+    *timer1_data = 0;
+    *timer1_control = TIMER_ENABLE | TIMER_FREQ_64;
+}
+
+/* queue a job with a per frame budget in cycles, returns the task or 0 if
+ * the queue is full */
+struct Task* task_add(int (*step)(struct Task* task), unsigned int budget) {
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (!tasks[i].active) {
+            tasks[i].step = step;
+            tasks[i].position = 0;
+            tasks[i].budget = budget;
+            tasks[i].used = 0;
+            tasks[i].overruns = 0;
+            tasks[i].active = 1;
+            return &tasks[i];
+        }
     }
-    for(int i = 0; i < (map2_width* map2_height); i++){
-        dest2[i] = map2[i];
+    return 0;
+}
+
+/* returns whether any task still has work to do */
+int tasks_pending() {
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (tasks[i].active) {
+            return 1;
+        }
     }
+    return 0;
 }
 
-/* just kill time */
-void delay(unsigned int amount) {
-    for (int i = 0; i < amount * 10; i++);
+/* give each task its slices for this frame, a task keeps going while the
+ * next slice (guessed from the last one) still fits in its budget, and always
+ * gets at least one slice so it makes progress */
+void scheduler_run() {
+    for (int i = 0; i < MAX_TASKS; i++) {
+        struct Task* task = &tasks[i];
+        if (!task->active) {
+            continue;
+        }
+
+        unsigned int used = 0;
+        unsigned int slice = 0;
+        do {
+            unsigned short start = *timer1_data;
+            if (task->step(task)) {
+                task->active = 0;
+            }
+            slice = (unsigned short) (*timer1_data - start) * 64;
+            used += slice;
+        } while (task->active && used + slice <= task->budget);
+
+        task->used = used;
+        if (used > task->budget) {
+            task->overruns++;
+        }
+    }
 }
 
 /* a sprite is a moveable image on the screen */
@@ -202,7 +1098,33 @@ struct Sprite {
 
 /* array of all the sprites available on the GBA */
 struct Sprite sprites[NUM_SPRITES];
-int next_sprite_index = 0;
+
+/* the shadow copy of OAM which sprites are sorted into each frame */
+struct Sprite oam_shadow[NUM_SPRITES];
+
+/* the free list is a stack of unused sprite slots so alloc/free are O(1) */
+unsigned char sprite_free_list[NUM_SPRITES];
+int sprite_free_count = 0;
+
+/* the live list holds every allocated slot, sprite_live_pos maps a slot back
+ * to its place in the live list so it can be removed in O(1) */
+unsigned char sprite_live[NUM_SPRITES];
+unsigned char sprite_live_pos[NUM_SPRITES];
+int sprite_live_count = 0;
+
+/* the live list position of a slot which is free */
+#define SPRITE_NOT_LIVE 0xff
+
+/* sprite_init hands this out when OAM is full, it's never drawn so the
+ * caller can keep using it, but it should check for it and give up on
+ * whatever needed the sprite */
+struct Sprite sprite_none;
+
+/* sorting depth of each sprite, 0 is drawn in front */
+unsigned char sprite_depth[NUM_SPRITES];
+
+/* attribute0 value which turns off rendering of a sprite */
+#define SPRITE_HIDDEN 0x0200
 
 /* the different sizes of sprites which are possible */
 enum SpriteSize {
@@ -220,12 +1142,94 @@ enum SpriteSize {
     SIZE_32_64
 };
 
-/* function to initialize a sprite with its properties, and return a pointer */
+/* take a slot off the free list and mark it live, returns -1 if OAM is full */
+int sprite_alloc() {
+    if (sprite_free_count == 0) {
+        return -1;
+    }
+    int index = sprite_free_list[--sprite_free_count];
+
+    /* add it to the end of the live list */
+    sprite_live_pos[index] = sprite_live_count;
+    sprite_live[sprite_live_count++] = index;
+    sprite_depth[index] = 0;
+    return index;
+}
+
+/* give a sprite's slot back to the free list and hide it, freeing
+ * sprite_none or a slot which is already free does nothing */
+void sprite_free(struct Sprite* sprite) {
+    if (sprite == &sprite_none) {
+        return;
+    }
+    int index = sprite - sprites;
+    if (sprite_live_pos[index] == SPRITE_NOT_LIVE) {
+        return;
+    }
+
+    /* move the last live slot into the hole this one leaves */
+    int pos = sprite_live_pos[index];
+    int last = sprite_live[--sprite_live_count];
+    sprite_live[pos] = last;
+    sprite_live_pos[last] = pos;
+    sprite_live_pos[index] = SPRITE_NOT_LIVE;
+
+    /* hide it and push it back on the free list */
+    sprite->attribute0 = SPRITE_HIDDEN;
+    sprite->attribute1 = 0;
+    sprite_free_list[sprite_free_count++] = index;
+}
+
+/* the free and live lists, the run ahead snapshot keeps a copy of these
+ * since obstacles take and give back slots as they come and go */
+struct SpriteLists {
+    unsigned char free_list[NUM_SPRITES];
+    unsigned char live[NUM_SPRITES];
+    unsigned char live_pos[NUM_SPRITES];
+    int free_count;
+    int live_count;
+};
+
+/* copy the allocator's lists out and back in, the sprites themselves
+ * are up to whoever owns them */
+void sprite_lists_save(struct SpriteLists* lists) {
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        lists->free_list[i] = sprite_free_list[i];
+        lists->live[i] = sprite_live[i];
+        lists->live_pos[i] = sprite_live_pos[i];
+    }
+    lists->free_count = sprite_free_count;
+    lists->live_count = sprite_live_count;
+}
+void sprite_lists_restore(const struct SpriteLists* lists) {
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        sprite_free_list[i] = lists->free_list[i];
+        sprite_live[i] = lists->live[i];
+        sprite_live_pos[i] = lists->live_pos[i];
+    }
+    sprite_free_count = lists->free_count;
+    sprite_live_count = lists->live_count;
+}
+
+/* set the depth used to order sprites which share a priority, 0 is in front */
+void sprite_set_depth(struct Sprite* sprite, int depth) {
+    if (sprite != &sprite_none) {
+        sprite_depth[sprite - sprites] = depth;
+    }
+}
+
+/* function to initialize a sprite with its properties, and return a pointer
+ * to it, or to sprite_none if every slot is in use */
 struct Sprite* sprite_init(int x, int y, enum SpriteSize size,
     int horizontal_flip, int vertical_flip, int tile_index, int priority) {
 
-    /* grab the next index */
-    int index = next_sprite_index++;
+    /* grab a free slot, taking one somebody else owns would leave two
+     * owners freeing the same slot */
+    int index = sprite_alloc();
+    if (index < 0) {
+        sprite_none.attribute0 = SPRITE_HIDDEN;
+        return &sprite_none;
+    }
 
     /* setup the bits used for each shape/size possible */
     int size_bits, shape_bits;
@@ -252,7 +1256,7 @@ struct Sprite* sprite_init(int x, int y, enum SpriteSize size,
                             (0 << 8) |          /* rendering mode */
                             (0 << 10) |         /* gfx mode */
                             (0 << 12) |         /* mosaic */
-                            (1 << 13) |         /* color mode, 0:16, 1:256 */
+                            (SPRITE_COLOR_MODE << 13) | /* color mode, 0:16, 1:256 */
                             (shape_bits << 14); /* shape */
 
     /* set up the second attribute */
@@ -271,21 +1275,95 @@ struct Sprite* sprite_init(int x, int y, enum SpriteSize size,
     return &sprites[index];
 }
 
+/* sort the live sprites by priority then depth into the shadow OAM
+ * this is a two pass LSD radix sort, first on depth then on priority, so
+ * sprites that share a priority keep their depth order */
+void sprite_sort() {
+    int count = sprite_live_count;
+
+    /* scratch space for the radix sort, it's only needed until we're done */
+    arena_reset(&scratch_arena);
+    unsigned char* sprite_sort_tmp = arena_alloc(&scratch_arena, NUM_SPRITES);
+    unsigned char* sprite_sort_out = arena_alloc(&scratch_arena, NUM_SPRITES);
+    unsigned char* sprite_bucket = arena_alloc(&scratch_arena, 256);
+
+    /* pass 1: counting sort on the depth byte */
+    for (int i = 0; i < 256; i++) {
+        sprite_bucket[i] = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        sprite_bucket[sprite_depth[sprite_live[i]]]++;
+    }
+    int total = 0;
+    for (int i = 0; i < 256; i++) {
+        int c = sprite_bucket[i];
+        sprite_bucket[i] = total;
+        total += c;
+    }
+    for (int i = 0; i < count; i++) {
+        int index = sprite_live[i];
+        sprite_sort_tmp[sprite_bucket[sprite_depth[index]]++] = index;
+    }
+
+    /* pass 2: counting sort on the 2 priority bits of attribute 2 */
+    int start[4] = {0, 0, 0, 0};
+    for (int i = 0; i < count; i++) {
+        start[(sprites[sprite_sort_tmp[i]].attribute2 >> 10) & 3]++;
+    }
+    total = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = start[i];
+        start[i] = total;
+        total += c;
+    }
+    for (int i = 0; i < count; i++) {
+        int index = sprite_sort_tmp[i];
+        sprite_sort_out[start[(sprites[index].attribute2 >> 10) & 3]++] = index;
+    }
+
+    /* copy them into the shadow table in sorted order, the fourth attribute
+     * is left alone since it isn't part of the sprite */
+    for (int i = 0; i < count; i++) {
+        struct Sprite* sprite = &sprites[sprite_sort_out[i]];
+        oam_shadow[i].attribute0 = sprite->attribute0;
+        oam_shadow[i].attribute1 = sprite->attribute1;
+        oam_shadow[i].attribute2 = sprite->attribute2;
+    }
+
+    /* hide all the slots nobody is using */
+    for (int i = count; i < NUM_SPRITES; i++) {
+        oam_shadow[i].attribute0 = SPRITE_HIDDEN;
+    }
+}
+
+/* copy the shadow table to the screen, call in vblank */
+void sprite_upload() {
+    memcpy16_dma((unsigned short*) sprite_attribute_memory, (unsigned short*) oam_shadow, NUM_SPRITES * 4);
+}
+
 /* update all of the spries on the screen */
 void sprite_update_all() {
+    /* sort them into the shadow table */
+    sprite_sort();
+
     /* copy them all over */
-    memcpy16_dma((unsigned short*) sprite_attribute_memory, (unsigned short*) sprites, NUM_SPRITES * 4);
+    sprite_upload();
 }
 
 /* setup all sprites */
 void sprite_clear() {
-    /* clear the index counter */
-    next_sprite_index = 0;
+    /* put every slot back on the free list, lowest index on top */
+    sprite_live_count = 0;
+    sprite_free_count = NUM_SPRITES;
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        sprite_free_list[i] = NUM_SPRITES - 1 - i;
+        sprite_live_pos[i] = SPRITE_NOT_LIVE;
+    }
 
     /* move all sprites offscreen to hide them */
     for(int i = 0; i < NUM_SPRITES; i++) {
-        sprites[i].attribute0 = SCREEN_HEIGHT;
-        sprites[i].attribute1 = SCREEN_WIDTH;
+        sprites[i].attribute0 = SPRITE_HIDDEN;
+        sprites[i].attribute1 = 0;
     }
 }
 
@@ -347,30 +1425,285 @@ void sprite_set_offset(struct Sprite* sprite, int offset) {
     sprite->attribute2 |= (offset & 0x03ff);
 }
 
-/* setup the sprite image and palette */
-void setup_sprite_image() {
-    /* load the palette from the image into palette memory*/
-    memcpy16_dma((unsigned short*) sprite_palette, (unsigned short*) koopa_palette, PALETTE_SIZE);
+/* sine table for 256 angles in a circle, 1.0 is 4096 */
+const short sin_table[256] = {
+    0, 101, 201, 301, 401, 501, 601, 700,
+    799, 897, 995, 1092, 1189, 1285, 1380, 1474,
+    1567, 1660, 1751, 1842, 1931, 2019, 2106, 2191,
+    2276, 2359, 2440, 2520, 2598, 2675, 2751, 2824,
+    2896, 2967, 3035, 3102, 3166, 3229, 3290, 3349,
+    3406, 3461, 3513, 3564, 3612, 3659, 3703, 3745,
+    3784, 3822, 3857, 3889, 3920, 3948, 3973, 3996,
+    4017, 4036, 4052, 4065, 4076, 4085, 4091, 4095,
+    4096, 4095, 4091, 4085, 4076, 4065, 4052, 4036,
+    4017, 3996, 3973, 3948, 3920, 3889, 3857, 3822,
+    3784, 3745, 3703, 3659, 3612, 3564, 3513, 3461,
+    3406, 3349, 3290, 3229, 3166, 3102, 3035, 2967,
+    2896, 2824, 2751, 2675, 2598, 2520, 2440, 2359,
+    2276, 2191, 2106, 2019, 1931, 1842, 1751, 1660,
+    1567, 1474, 1380, 1285, 1189, 1092, 995, 897,
+    799, 700, 601, 501, 401, 301, 201, 101,
+    0, -101, -201, -301, -401, -501, -601, -700,
+    -799, -897, -995, -1092, -1189, -1285, -1380, -1474,
+    -1567, -1660, -1751, -1842, -1931, -2019, -2106, -2191,
+    -2276, -2359, -2440, -2520, -2598, -2675, -2751, -2824,
+    -2896, -2967, -3035, -3102, -3166, -3229, -3290, -3349,
+    -3406, -3461, -3513, -3564, -3612, -3659, -3703, -3745,
+    -3784, -3822, -3857, -3889, -3920, -3948, -3973, -3996,
+    -4017, -4036, -4052, -4065, -4076, -4085, -4091, -4095,
+    -4096, -4095, -4091, -4085, -4076, -4065, -4052, -4036,
+    -4017, -3996, -3973, -3948, -3920, -3889, -3857, -3822,
+    -3784, -3745, -3703, -3659, -3612, -3564, -3513, -3461,
+    -3406, -3349, -3290, -3229, -3166, -3102, -3035, -2967,
+    -2896, -2824, -2751, -2675, -2598, -2520, -2440, -2359,
+    -2276, -2191, -2106, -2019, -1931, -1842, -1751, -1660,
+    -1567, -1474, -1380, -1285, -1189, -1092, -995, -897,
+    -799, -700, -601, -501, -401, -301, -201, -101
+};
 
-    /* load the image into char block 0 */
-    memcpy16_dma((unsigned short*) sprite_image_memory, (unsigned short*) koopa_data, (koopa_width * koopa_height) / 2);
+/* look up sine and cosine for an angle where 256 is a full turn */
+int lu_sin(int angle) {
+    return sin_table[angle & 0xff];
+}
+int lu_cos(int angle) {
+    return sin_table[(angle + 64) & 0xff];
 }
 
-/* a struct for the koopa's logic and behavior */
-struct Koopa {
-    /* the actual sprite attribute info */
-    struct Sprite* sprite;
+/* there are 32 affine matrices, stored in the fourth attribute of every
+ * group of 4 sprites in OAM */
+#define NUM_AFFINE 32
 
-    /* the x and y postion, in 1/256 pixels */
-    int x, y;
+/* the transform each matrix was made for so sprites can share them */
+unsigned char affine_angle[NUM_AFFINE];
+unsigned short affine_scale[NUM_AFFINE];
 
-    /* the koopa's y velocity in 1/256 pixels/second */
-    int yvel;
+/* how many sprites are using each matrix, 0 means it's free */
+unsigned char affine_refs[NUM_AFFINE];
 
-    /* the koopa's y acceleration in 1/256 pixels/second^2 */
-    int gravity; 
+/* write the four parameters of a matrix into the shadow OAM */
+void affine_write(int index, int pa, int pb, int pc, int pd) {
+    struct Sprite* base = &oam_shadow[index * 4];
+    base[0].attribute3 = pa;
+    base[1].attribute3 = pb;
+    base[2].attribute3 = pc;
+    base[3].attribute3 = pd;
+}
 
-    /* which frame of the animation he is on */
+/* get a matrix which rotates by angle (256 is a full turn) and scales by
+ * scale (256 is normal size), reusing an existing one if some other sprite
+ * already has the same transform, returns -1 if all 32 are in use */
+int affine_get(int angle, int scale) {
+    angle &= 0xff;
+
+    /* look for a matrix which already has this transform */
+    int free = -1;
+    for (int i = 0; i < NUM_AFFINE; i++) {
+        if (affine_refs[i] == 0) {
+            if (free < 0) {
+                free = i;
+            }
+        } else if (affine_angle[i] == angle && affine_scale[i] == scale) {
+            affine_refs[i]++;
+            return i;
+        }
+    }
+    if (free < 0) {
+        return -1;
+    }
+
+    /* the matrix maps screen to texture space so it uses the inverse scale,
+     * 8.8 fixed point on both sides so sin and cos come down from 1.12 */
+    int c = (lu_cos(angle) << 4) / scale;
+    int s = (lu_sin(angle) << 4) / scale;
+    affine_write(free, c, -s, s, c);
+    affine_angle[free] = angle;
+    affine_scale[free] = scale;
+    affine_refs[free] = 1;
+    return free;
+}
+
+/* let go of a matrix from affine_get */
+void affine_release(int index) {
+    if (index >= 0 && affine_refs[index] > 0) {
+        affine_refs[index]--;
+    }
+}
+
+/* free all the matrices */
+void affine_clear() {
+    for (int i = 0; i < NUM_AFFINE; i++) {
+        affine_refs[i] = 0;
+    }
+}
+
+/* turn on affine rendering for a sprite using one of the 32 matrices, the
+ * double size flag keeps rotated corners from being clipped
+ * note the matrix index uses the same bits as the flip flags */
+void sprite_set_affine(struct Sprite* sprite, int matrix, int double_size) {
+    int d = double_size ? 1 : 0;
+    sprite->attribute0 = (sprite->attribute0 & 0xfcff) | (1 << 8) | (d << 9);
+    sprite->attribute1 = (sprite->attribute1 & 0xc1ff) | ((matrix & 0x1f) << 9);
+}
+
+/* go back to normal rendering */
+void sprite_clear_affine(struct Sprite* sprite) {
+    sprite->attribute0 &= 0xfcff;
+    sprite->attribute1 &= 0xc1ff;
+}
+
+#ifdef BENCHMARKS
+/* time the matrix setup for 32 rotating sprites, once where every sprite
+ * has its own angle and once where they all share the same one */
+void affine_benchmark() {
+    int matrix[32];
+
+    affine_clear();
+    profile_start();
+    for (int i = 0; i < 32; i++) {
+        matrix[i] = affine_get(i * 8, 256);
+    }
+    profile_cycles[PROFILE_AFFINE_COLD] = profile_stop();
+
+    affine_clear();
+    profile_start();
+    for (int i = 0; i < 32; i++) {
+        matrix[i] = affine_get(32, 256);
+    }
+    profile_cycles[PROFILE_AFFINE_WARM] = profile_stop();
+
+    for (int i = 0; i < 32; i++) {
+        affine_release(matrix[i]);
+    }
+}
+#endif
+
+/* setup the sprite image and palette */
+void setup_sprite_image() {
+#ifdef SPRITES_4BPP
+    /* load the one palette bank the sprites use */
+    memcpy16_dma(palette_source + PALETTE_SIZE, (unsigned short*) koopa_4bpp_palette, 16);
+
+    /* load the 4bpp image into char block 0 */
+    memcpy16_dma((unsigned short*) sprite_image_memory, (unsigned short*) koopa_4bpp_data, koopa_4bpp_tiles * 16);
+#else
+    /* load the palette from the image, it goes to palette memory the next
+     * time the palette is committed */
+    memcpy16_dma(palette_source + PALETTE_SIZE, (unsigned short*) koopa_palette, PALETTE_SIZE);
+
+    /* load the image into char block 0 */
+    memcpy16_dma((unsigned short*) sprite_image_memory, (unsigned short*) koopa_data, (koopa_width * koopa_height) / 2);
+#endif
+    palette_rebuild();
+}
+
+#ifdef BENCHMARKS
+/* time one frame's worth of 100 scripts, after a few frames to get them all
+ * to different places */
+void script_benchmark() {
+    struct BenchActor actors[BENCH_SCRIPTS];
+    for (int i = 0; i < BENCH_SCRIPTS; i++) {
+        script_reset(&actors[i].script);
+        actors[i].x = 0;
+    }
+    for (int frame = 0; frame < 5; frame++) {
+        if (frame == 4) {
+            profile_start();
+        }
+        for (int i = 0; i < BENCH_SCRIPTS; i++) {
+            bench_script(&actors[i]);
+        }
+    }
+    profile_cycles[PROFILE_SCRIPTS_100] = profile_stop();
+}
+#endif
+
+/* a jump's height above where it took off on each tick until it lands, so
+ * jumping is a table lookup and where a jump comes down can be worked out
+ * without running it */
+struct JumpArc {
+    /* the offset from the take off point in 1/256 pixels, one per tick */
+    const short* offset;
+
+    /* the starting y velocity and gravity the table was made with */
+    int velocity, gravity;
+
+    /* the tick the jump peaks on and the tick it's back down on */
+    int apex, landing;
+
+    /* how high the jump goes in 1/256 pixels */
+    int height;
+};
+
+/* these have to be kept in the same order as the jumps given to jumpgen */
+enum JumpKind {
+    ARC_KOOPA,
+    ARC_KOOPA2
+};
+const struct JumpArc jump_arcs[] = {
+    { jump_koopa, JUMP_KOOPA_VELOCITY, JUMP_KOOPA_GRAVITY,
+      JUMP_KOOPA_APEX, JUMP_KOOPA_LANDING, JUMP_KOOPA_HEIGHT },
+    { jump_koopa2, JUMP_KOOPA2_VELOCITY, JUMP_KOOPA2_GRAVITY,
+      JUMP_KOOPA2_APEX, JUMP_KOOPA2_LANDING, JUMP_KOOPA2_HEIGHT },
+};
+
+/* where an actor is along its jump */
+struct Jump {
+    const struct JumpArc* arc;
+
+    /* the tick of the arc it's on, or -1 if it isn't jumping */
+    int tick;
+
+    /* the y it took off from */
+    int base;
+};
+
+/* start a jump from height y */
+void jump_start(struct Jump* jump, int y) {
+    jump->tick = 0;
+    jump->base = y;
+}
+
+/* stop following the arc, when the actor lands */
+void jump_end(struct Jump* jump) {
+    jump->tick = -1;
+}
+
+/* move an airborne actor on one tick, along the arc if it's jumping, once
+ * the arc runs out (it's gone past a ledge) or if it walked off one it falls
+ * the old way, the velocity is kept up to date so that still works */
+void jump_step(struct Jump* jump, int* y, int* yvel, int gravity) {
+    const struct JumpArc* arc = jump->arc;
+    if (jump->tick >= 0 && jump->tick < arc->landing) {
+        jump->tick++;
+        *y = jump->base + arc->offset[jump->tick];
+        *yvel = arc->velocity + jump->tick * arc->gravity;
+    } else {
+        jump->tick = -1;
+        *y += *yvel;
+        *yvel += gravity;
+    }
+}
+
+/* how far a jump goes across when moving speed pixels a tick */
+static inline int jump_distance(const struct JumpArc* arc, int speed) {
+    return arc->landing * speed;
+}
+
+/* a struct for the koopa's logic and behavior */
+struct Koopa {
+    /* the actual sprite attribute info */
+    struct Sprite* sprite;
+
+    /* the x and y postion, in 1/256 pixels */
+    int x, y;
+
+    /* the koopa's y velocity in 1/256 pixels/tick */
+    int yvel;
+
+    /* the koopa's y acceleration in 1/256 pixels/tick^2 */
+    int gravity; 
+
+    /* which frame of the animation he is on */
     int frame;
 
     /* the number of frames to wait before flipping */
@@ -387,6 +1720,9 @@ struct Koopa {
 
     /* if the koopa is currently falling */
     int falling;
+
+    /* the arc of the current jump */
+    struct Jump jump;
 };
 
 /* a struct for the koopa's logic and behavior */
@@ -397,10 +1733,10 @@ struct Koopa2 {
     /* the x and y postion, in 1/256 pixels */
     int x, y;
 
-    /* the koopa's y velocity in 1/256 pixels/second */
+    /* the koopa's y velocity in 1/256 pixels/tick */
     int yvel;
 
-    /* the koopa's y acceleration in 1/256 pixels/second^2 */
+    /* the koopa's y acceleration in 1/256 pixels/tick^2 */
     int gravity; 
 
     /* which frame of the animation he is on */
@@ -420,20 +1756,33 @@ struct Koopa2 {
 
     /* if the koopa is currently falling */
     int falling;
+
+    /* the arc of the current jump */
+    struct Jump jump;
+
+    /* the script which drives what this koopa does */
+    struct Script script;
 };
 
-/* initialize the koopa */
+/* the koopas come out of entity_pool, so they have to fit in an entity */
+typedef char koopa_fits_in_an_entity[sizeof(struct Koopa) <= ENTITY_SIZE ? 1 : -1];
+typedef char koopa2_fits_in_an_entity[sizeof(struct Koopa2) <= ENTITY_SIZE ? 1 : -1];
+
+/* initialize the koopa, speeds are per logic tick which is one vblank,
+ * about 1/59.73 second */
 void koopa_init(struct Koopa* koopa) {
     koopa->x = 100 << 8;
     koopa->y = 113 << 8;
     koopa->yvel = 0;
-    koopa->gravity = 90;
+    koopa->gravity = JUMP_KOOPA_GRAVITY;
     koopa->border = 70;
     koopa->frame = 0;
     koopa->move = 0;
     koopa->counter = 0;
     koopa->falling = 20;
     koopa->animation_delay = 6;
+    koopa->jump.arc = &jump_arcs[ARC_KOOPA];
+    jump_end(&koopa->jump);
     koopa->sprite = sprite_init(koopa->x >> 8, koopa->y >> 8, SIZE_16_32, 0, 0, koopa->frame, 0);
 }
 
@@ -442,13 +1791,16 @@ void koopa2_init(struct Koopa2* koopa2) {
     koopa2->x = 100 << 8;
     koopa2->y = 113 << 8;
     koopa2->yvel = 0;
-    koopa2->gravity = 50;
+    koopa2->gravity = JUMP_KOOPA2_GRAVITY;
     koopa2->border = -10;
     koopa2->frame = 0;
     koopa2->move = 3;
     koopa2->counter = 0;
     koopa2->falling = 0;
     koopa2->animation_delay = 6;
+    koopa2->jump.arc = &jump_arcs[ARC_KOOPA2];
+    jump_end(&koopa2->jump);
+    script_reset(&koopa2->script);
     koopa2->sprite = sprite_init(koopa2->x >> 8, koopa2->y >> 8, SIZE_16_32, 0, 0, koopa2->frame, 0);
 }
 
@@ -474,15 +1826,32 @@ int koopa2_left(struct Koopa2* koopa2, int num) {
     sprite_set_horizontal_flip(koopa2->sprite, 1);
     koopa2->move = 1 + num;
 
-    /* if we are at the left end, just scroll the screen */
-    if ((koopa2->x >> 8) == koopa2->border) {
-        koopa2->x = 100 << 9;    
+    /* if we are at the left end, stop */
+    if ((koopa2->x >> 8) <= koopa2->border) {
+        return 1;
     } 
     else {
         /* else move left */
         koopa2->x -= 256;
+        return 0;
     }
-    return 0;
+}
+
+/* what koopa2 does, walk left across the screen and then come back around
+ * from the right after a short wait */
+int koopa2_script(struct Koopa2* koopa2, int speed) {
+    SCRIPT_BEGIN(&koopa2->script);
+    while (1) {
+        /* walk left until we hit the border */
+        while (!koopa2_left(koopa2, speed)) {
+            SCRIPT_YIELD(&koopa2->script);
+        }
+
+        /* go off the right side of the screen and wait there a bit */
+        koopa2->x = (SCREEN_WIDTH + 16) << 8;
+        SCRIPT_WAIT_TICKS(&koopa2->script, 30);
+    }
+    SCRIPT_END(&koopa2->script);
 }
 
 int koopa_right(struct Koopa* koopa) {
@@ -531,94 +1900,218 @@ void koopa2_stop(struct Koopa2* koopa2) {
     sprite_set_offset(koopa2->sprite, koopa2->frame);
 }
 
-/* start the koopa jumping, unless already fgalling */
-void koopa_jump(struct Koopa* koopa) {
+/* start the koopa jumping without a sound, unless already falling, returns
+ * whether it did */
+int koopa_start_jump(struct Koopa* koopa) {
     if (!koopa->falling) {
-        koopa->yvel = -1500;
+        koopa->yvel = koopa->jump.arc->velocity;
         koopa->falling = 1;
-        // koopa->x = 100 << 8;
+        jump_start(&koopa->jump, koopa->y);
+        return 1;
+    }
+    return 0;
+}
+
+/* start the koopa jumping with the sound, unless already falling */
+void koopa_jump(struct Koopa* koopa) {
+    if (koopa_start_jump(koopa)) {
+        sound_queue(sound_jump, SOUND_JUMP_LENGTH, 4096, 48, 0);
     }
 }
 
 /* start the koopa jumping, unless already fgalling */
-void koopa2_jump(struct Koopa* koopa) {
-    if (!koopa->falling) {
-        koopa->yvel = -1500;
-        koopa->falling = 1;
+void koopa2_jump(struct Koopa2* koopa2) {
+    if (!koopa2->falling) {
+        koopa2->yvel = koopa2->jump.arc->velocity;
+        koopa2->falling = 1;
+        jump_start(&koopa2->jump, koopa2->y);
     }
 }
-/* finds which tile a screen coordinate maps to, taking scroll into account */
-unsigned short tile_lookup(int x, int y, int xscroll, int yscroll,
-        const unsigned short* tilemap, int tilemap_w, int tilemap_h) {
 
-    /* adjust for the scroll */
-    x += xscroll;
-    y += yscroll;
 
-    /* convert from screen coordinates to tile coordinates */
-    x >>= 3;
-    y >>= 3;
+/* the height of the ground in each pixel column of the level, worked out
+ * once from the map and the tile images so landing is one table read
+ * the map is 32 tiles wide and wraps, so there are 256 columns */
+#define GROUND_WIDTH (mapBack_width * 8)
+#define GROUND_NONE 0xff
+unsigned char ground_height[GROUND_WIDTH];
 
-    /* account for wraparound */
-    while (x >= tilemap_w) {
-        x -= tilemap_w;
-    }
-    while (y >= tilemap_h) {
-        y -= tilemap_h;
+/* what a tile's ground is like, the map only has solid ground so far */
+#define GROUND_SOLID 1       /* stands on it and can't fall through */
+
+/* which tiles of the map are ground, the block tiles the koopa walks on are
+ * the ones after 510 */
+struct GroundKind {
+    unsigned short first, last;
+    unsigned char flags;
+};
+const struct GroundKind ground_kinds[] = {
+    { 511, 1023, GROUND_SOLID },
+};
+#define NUM_GROUND_KINDS (sizeof(ground_kinds) / sizeof(ground_kinds[0]))
+
+/* the ground flags of one tile, 0 if it isn't ground */
+int ground_tile_flags(int tile) {
+    for (int i = 0; i < (int) NUM_GROUND_KINDS; i++) {
+        if (tile >= ground_kinds[i].first && tile <= ground_kinds[i].last) {
+            return ground_kinds[i].flags;
+        }
     }
-    while (x < 0) {
-        x += tilemap_w;
+    return 0;
+}
+
+/* one bit for each of the 1024 tile numbers, set if it is ground, filled in
+ * by ground_build so tile_query_box doesn't go through ground_kinds */
+unsigned int tile_solid[1024 / 32];
+
+/* scan down each pixel column of the map for the first pixel that is drawn
+ * in a ground tile, taking the tile's flip bits into account */
+void ground_build(const unsigned short* tilemap, int tilemap_w, int tilemap_h,
+        const unsigned char* tiles) {
+    for (int tile = 0; tile < 1024; tile++) {
+        if (ground_tile_flags(tile)) {
+            tile_solid[tile >> 5] |= 1u << (tile & 31);
+        } else {
+            tile_solid[tile >> 5] &= ~(1u << (tile & 31));
+        }
     }
-    while (y < 0) {
-        y += tilemap_h;
+
+    for (int column = 0; column < tilemap_w * 8; column++) {
+        ground_height[column] = GROUND_NONE;
+
+        for (int y = 0; y < tilemap_h * 8 && ground_height[column] == GROUND_NONE; y++) {
+            unsigned short entry = tilemap[(y >> 3) * tilemap_w + (column >> 3)];
+            if (!ground_tile_flags(entry & 0x3ff)) {
+                /* skip the rest of this tile */
+                y |= 7;
+                continue;
+            }
+
+            /* bit 10 flips the tile horizontally and bit 11 vertically */
+            int px = (entry & 0x400) ? 7 - (column & 7) : (column & 7);
+            int py = (entry & 0x800) ? 7 - (y & 7) : (y & 7);
+
+            /* two pixels a byte, the left one in the low nibble */
+            unsigned char pair = tiles[(entry & 0x3ff) * 32 + py * 4 + (px >> 1)];
+            int pixel = (px & 1) ? pair >> 4 : pair & 0xf;
+            if (pixel) {
+                ground_height[column] = y;
+            }
+        }
     }
+}
+
+/* the ground is drawn on bg0, which scrolls twice as fast as the hills on
+ * bg1, so anything standing on it has to go by this scroll and not xscroll */
+#define GROUND_SCROLL(xscroll) ((xscroll) * 2)
 
-    /* lookup this tile from the map */
-    int index = y * tilemap_w + x;
+/* the ground under a screen x coordinate, in pixels from the top of the
+ * level, or GROUND_NONE if there's nothing to stand on */
+static inline int ground_at(int x, int xscroll) {
+    return ground_height[(x + GROUND_SCROLL(xscroll)) & (GROUND_WIDTH - 1)];
+}
 
-    /* return the tile */
-    return tilemap[index];
+/* stand an actor with its feet feet pixels below y on the ground under x, or
+ * start it falling, returns 1 if it is on the ground */
+int ground_land(int x, int* y, int* yvel, int* falling, int feet, int xscroll) {
+    int height = ground_at(x, xscroll);
+    if (height != GROUND_NONE) {
+        int top = (height - feet) << 8;
+        if (*y >= top) {
+            *y = top;
+            *yvel = 0;
+            *falling = 0;
+            return 1;
+        }
+    }
+    *falling = 1;
+    return 0;
 }
 
 
-/* update the koopa */
-void koopa_update(struct Koopa* koopa,struct Koopa2* koopa2, int xscroll) {
-    /* update y position and speed if falling */
-    if (koopa->falling) {
-        koopa->y += koopa->yvel;
-        koopa->yvel += koopa->gravity;
+#ifdef BENCHMARKS
+/* check a 16x32 box (the koopa's size, 15 points) 100 times with one
+ * tile_lookup per point and then with tile_query_box */
+void tile_query_benchmark() {
+    volatile unsigned int sink = 0;
+
+    profile_start();
+    for (int i = 0; i < 100; i++) {
+        unsigned int result = 0;
+        int bit = 0;
+        for (int dy = 0; dy < 5; dy++) {
+            for (int dx = 0; dx < 3; dx++, bit++) {
+                int tile = tile_lookup(i + (dx == 2 ? 15 : dx * 8), 120 + (dy == 4 ? 31 : dy * 8),
+                        i, 0, mapBack, mapBack_width, mapBack_height) & 0x3ff;
+                if (tile_solid[tile >> 5] & (1u << (tile & 31))) {
+                    result |= 1u << bit;
+                }
+            }
+        }
+        sink = result;
     }
+    profile_cycles[PROFILE_BOX_SCALAR] = profile_stop();
 
-    /* check which tile the koopa's feet are over */
-    unsigned short tile = tile_lookup((koopa->x >> 8) + 8, (koopa->y >> 8) + 32, xscroll, 0, mapBack, mapBack_width, mapBack_height);
-    unsigned short tile2 = tile_lookup((koopa2->x >> 8) + 8, (koopa2->y >> 8) + 32, xscroll, 0, mapBack, mapBack_width, mapBack_height);
+    profile_start();
+    for (int i = 0; i < 100; i++) {
+        sink = tile_query_box(i, 120, 16, 32, i, 0, mapBack, mapBack_width, mapBack_height, 0);
+    }
+    profile_cycles[PROFILE_BOX_BATCHED] = profile_stop();
 
-    /* if it's block tile
-     * these numbers refer to the tile indices of the blocks the koopa can walk on */
-    if ((tile>510)){
-        /* stop the fall! */
-        koopa->falling = 0;
-        koopa->yvel = 0;
+    (void) sink;
+}
+#endif
 
-         // make him line up with the top of a block
-         // * works by clearing out the lower bits to 0 
-        koopa->y &= ~0x7ff;
-        /* move him down one because there is a one pixel gap in the image */
-        koopa->y++;
+#ifdef BENCHMARKS
+/* time code running from ROM (tile_lookup) and data being read from ROM
+ * (copying 8K of the tiles with the cpu) under each wait state setting */
+void waitstate_benchmark() {
+    const unsigned short settings[3] = { WAITCNT_DEFAULT, WAITCNT_3_1, WAITCNT_FAST };
+    volatile unsigned short sink = 0;
 
-    } 
-    else {
-         // he is falling now 
-        koopa->falling = 1;
+    for (int s = 0; s < 3; s++) {
+        *wait_control = settings[s];
+
+        profile_start();
+        for (int i = 0; i < 1000; i++) {
+            sink = tile_lookup(i & 0xff, 145, i, 0, mapBack, mapBack_width, mapBack_height);
+        }
+        profile_cycles[PROFILE_TILE_LOOKUP_DEFAULT + s] = profile_stop();
+
+        /* copy into the scratch arena so the destination is fast ram */
+        const unsigned int* source = (const unsigned int*) background_4bpp_data;
+        unsigned int* dest = (unsigned int*) iwram_scratch;
+        profile_start();
+        for (int i = 0; i < 8192 / 4; i++) {
+            dest[i & (SCRATCH_SIZE / 4 - 1)] = source[i];
+        }
+        profile_cycles[PROFILE_ROM_COPY_DEFAULT + s] = profile_stop();
+    }
+
+    (void) sink;
+    *wait_control = WAITCNT_STARTUP;
+}
+#endif
+
+/* update the koopa */
+void koopa_update(struct Koopa* koopa, int xscroll) {
+    /* update y position and speed if falling */
+    if (koopa->falling) {
+        jump_step(&koopa->jump, &koopa->y, &koopa->yvel, koopa->gravity);
     }
 
+    /* land on the ground under the koopa's feet, they're 8 pixels in and
+     * 32 pixels down from the corner of the sprite */
+    if (ground_land((koopa->x >> 8) + 8, &koopa->y, &koopa->yvel, &koopa->falling, 32, xscroll)) {
+        jump_end(&koopa->jump);
+    }
 
     /* update animation if moving */
     if (koopa->move) {
         koopa->counter++;
         if (koopa->counter >= koopa->animation_delay) {
-            koopa->frame = koopa->frame + 16;
-            if (koopa->frame > 16) {
+            koopa->frame = koopa->frame + SPRITE_FRAME_TILES;
+            if (koopa->frame > SPRITE_FRAME_TILES) {
                 koopa->frame = 0;
             }
             sprite_set_offset(koopa->sprite, koopa->frame);
@@ -632,43 +2125,23 @@ void koopa_update(struct Koopa* koopa,struct Koopa2* koopa2, int xscroll) {
 
 
 /* update the koopa */
-void koopa2_update(struct Koopa* koopa,struct Koopa2* koopa2, int xscroll) {
+void koopa2_update(struct Koopa2* koopa2, int xscroll) {
     /* update y position and speed if falling */
     if (koopa2->falling) {
-        koopa2->y += koopa2->yvel;
-        koopa2->yvel += koopa2->gravity;
+        jump_step(&koopa2->jump, &koopa2->y, &koopa2->yvel, koopa2->gravity);
     }
 
-    /* check which tile the koopa's feet are over */
-    unsigned short tile = tile_lookup((koopa->x >> 8) + 8, (koopa->y >> 8) + 32, xscroll,0, mapBack, mapBack_width, mapBack_height);
-
-    /* if it's block tile
-     * these numbers refer to the tile indices of the blocks the koopa can walk on */
-    if ((tile >= 1 && tile <= 6) || 
-        (tile >= 12 && tile <= 17) || tile <= 0x022b) {
-        /* stop the fall! */
-        koopa2->falling = 0;
-        koopa2->yvel = 0;
-
-        /* make him line up with the top of a block
-         * works by clearing out the lower bits to 0 */
-        koopa2->y &= ~0x7ff;
-
-        /* move him down one because there is a one pixel gap in the image */
-        koopa2->y++;
-    } 
-    else {
-        /* he is falling now */
-        koopa2->falling = 1;
+    /* land on the ground under this koopa's feet */
+    if (ground_land((koopa2->x >> 8) + 8, &koopa2->y, &koopa2->yvel, &koopa2->falling, 32, xscroll)) {
+        jump_end(&koopa2->jump);
     }
 
-
     /* update animation if moving */
     if (koopa2->move) {
         koopa2->counter++;
         if (koopa2->counter >= koopa2->animation_delay) {
-            koopa2->frame = koopa2->frame + 16;
-            if (koopa2->frame > 16) {
+            koopa2->frame = koopa2->frame + SPRITE_FRAME_TILES;
+            if (koopa2->frame > SPRITE_FRAME_TILES) {
                 koopa2->frame = 0;
             }
             sprite_set_offset(koopa2->sprite, koopa2->frame);
@@ -690,87 +2163,1201 @@ int check(struct Koopa* koopa,struct Koopa2* koopa2){
         return 0;
 }
 
+/* the random numbers the game uses, the level only depends on this state so
+ * saving it at the start of a run is enough to replay the run */
+struct Xorshift game_random = { 0x2545f491 };
+
+/* whether game_random has been seeded from the player yet, which happens
+ * before the first run starts */
+int random_seeded = 0;
+
+/* seed the game's random numbers from the frame count the first time any key
+ * is pressed, since nobody can time a press to the frame */
+void random_seed_from_input(unsigned short keys) {
+    if (!random_seeded && (keys & 0x3ff) != 0x3ff) {
+        xorshift_seed(&game_random, vblank_count * 2654435761u);
+        random_seeded = 1;
+    }
+}
+
+/* the random state the current run started with */
+struct Xorshift run_start_random;
+
+/* save and restore the random state, for replays and the run ahead
+ * snapshots, which must put it back or the level would change each frame */
+struct Xorshift random_save() {
+    return game_random;
+}
+void random_restore(struct Xorshift state) {
+    game_random = state;
+}
+
+#ifdef BENCHMARKS
+/* whether each generator passed random_check, xorshift then PCG, a 0 here
+ * means something's wrong with it */
+int random_passed[2];
+
+/* time 256 numbers from each generator and check they look random */
+void random_benchmark() {
+    static unsigned int numbers[RANDOM_CHI_COUNT];
+    struct Xorshift x;
+    struct Pcg p;
+    xorshift_seed(&x, 12345);
+    pcg_seed(&p, 12345, 54);
+
+    profile_start();
+    xorshift_fill(&x, numbers, 256);
+    profile_cycles[PROFILE_XORSHIFT_256] = profile_stop();
+
+    profile_start();
+    pcg_fill(&p, numbers, 256);
+    profile_cycles[PROFILE_PCG_256] = profile_stop();
+
+    xorshift_fill(&x, numbers, RANDOM_CHI_COUNT);
+    random_passed[0] = random_check(numbers);
+    pcg_fill(&p, numbers, RANDOM_CHI_COUNT);
+    random_passed[1] = random_check(numbers);
+}
+#endif
+
+/* obstacles are spawned procedurally as the screen scrolls, from a fixed
+ * ring of slots which are reused once they go off the left side */
+#define MAX_OBSTACLES 8
+
+/* the spacing between obstacles in pixels, plus a random amount up to 127 */
+#define OBSTACLE_MIN_GAP 96
+
+/* an obstacle sits still on the ground as the level scrolls by */
+struct Obstacle {
+    /* the actual sprite attribute info */
+    struct Sprite* sprite;
+
+    /* the x position along the ground (not the screen) and the y position */
+    int x, y;
+
+    /* whether this slot is in use, only then does it have a sprite */
+    int active;
+};
+
+struct Obstacle* obstacles;
+
+/* the slot the next obstacle goes into */
+int obstacle_next = 0;
+
+/* where in the level the next obstacle will appear */
+int obstacle_spawn_x = 0;
+
+/* set up the obstacle slots, they take a sprite when they spawn and give
+ * it back when they leave so there are none while a slot isn't in use */
+void obstacles_init() {
+    obstacles = arena_alloc(&level_arena, sizeof(struct Obstacle) * MAX_OBSTACLES);
+    obstacle_next = 0;
+    obstacle_spawn_x = SCREEN_WIDTH + 64;
+    for (int i = 0; i < MAX_OBSTACLES; i++) {
+        obstacles[i].active = 0;
+        obstacles[i].x = 0;
+        obstacles[i].y = 113;
+        obstacles[i].sprite = &sprite_none;
+    }
+}
+
+/* spawn and move the obstacles for one tick, this does the same amount of
+ * work every tick: at most one spawn and one pass over the slots, they sit
+ * on the ground so they move with GROUND_SCROLL */
+void obstacles_update(int xscroll, int speed) {
+    int scroll = GROUND_SCROLL(xscroll);
+
+    /* spawn the next one once its spot is about to scroll onto the screen */
+    if (scroll + SCREEN_WIDTH >= obstacle_spawn_x) {
+        struct Obstacle* obstacle = &obstacles[obstacle_next];
+        obstacle_next = (obstacle_next + 1) & (MAX_OBSTACLES - 1);
+
+        /* if the slot is still out it gives up its old sprite first, and
+         * if OAM is full it's skipped so there's never an obstacle you
+         * can't see, it's put in place by the loop below */
+        sprite_free(obstacle->sprite);
+        obstacle->sprite = sprite_init(SCREEN_WIDTH, SCREEN_HEIGHT, SIZE_16_32, 1, 0, 0, 0);
+        obstacle->active = obstacle->sprite != &sprite_none;
+        if (obstacle->active) {
+            obstacle->x = obstacle_spawn_x;
+            sprite_set_depth(obstacle->sprite, 1);
+        }
+
+        /* leave at least room to jump this one and land before the next,
+         * going by how fast the ground goes past the koopa */
+        int gap = jump_distance(&jump_arcs[ARC_KOOPA], GROUND_SCROLL(speed)) + 16;
+        if (gap < OBSTACLE_MIN_GAP) {
+            gap = OBSTACLE_MIN_GAP;
+        }
+        obstacle_spawn_x += gap + (xorshift_next(&game_random) & 127);
+    }
+
+    for (int i = 0; i < MAX_OBSTACLES; i++) {
+        struct Obstacle* obstacle = &obstacles[i];
+        if (!obstacle->active) {
+            continue;
+        }
+
+        /* recycle it once it's gone off the left side, giving its sprite
+         * back to the free list */
+        int x = obstacle->x - scroll;
+        if (x < -16) {
+            obstacle->active = 0;
+            sprite_free(obstacle->sprite);
+            obstacle->sprite = &sprite_none;
+        } else {
+            sprite_position(obstacle->sprite, x, obstacle->y);
+        }
+    }
+}
+
+/* check if the koopa ran into any of the obstacles, the boxes are a bit
+ * smaller than the sprites to be fair */
+int obstacles_hit(struct Koopa* koopa, int xscroll) {
+    int kx = koopa->x >> 8;
+    int ky = koopa->y >> 8;
+    for (int i = 0; i < MAX_OBSTACLES; i++) {
+        struct Obstacle* obstacle = &obstacles[i];
+        if (obstacle->active) {
+            int x = obstacle->x - GROUND_SCROLL(xscroll);
+            if (kx + 12 > x + 4 && kx + 4 < x + 12 &&
+                ky + 30 > obstacle->y + 6 && ky + 6 < obstacle->y + 32) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* the cartridge's battery backed SRAM, it is on an 8 bit bus so it has to be
+ * read and written one byte at a time */
+volatile unsigned char* save_memory = (volatile unsigned char*) 0xE000000;
+
+/* emulators and flash carts look for this string to know the game uses SRAM */
+const char save_type[] __attribute__((used, aligned(4))) = "SRAM_V113";
+
+/* what gets saved, the checksum is the last thing so a save which was cut
+ * off partway through never has a good checksum */
+#define SAVE_MAGIC 0x58455254
+#define SAVE_SEEDS 4
+struct SaveData {
+    unsigned int magic;
+
+    /* goes up with every save, so the newer of the two slots can be found */
+    unsigned int sequence;
+
+    unsigned int high_score;
+    unsigned int best_speed;
+
+    /* the random state at the start of the best runs, newest first */
+    unsigned int replay_seeds[SAVE_SEEDS];
+
+    unsigned int checksum;
+};
+
+/* there are two slots so the last good save is still there if the power goes
+ * out while writing the other one */
+#define SAVE_SLOT_SIZE 64
+
+/* how many bytes to write each frame so saving never takes a noticeable
+ * amount of time */
+#define SAVE_BYTES_PER_FRAME 8
+
+/* the saved data as the game sees it */
+struct SaveData save_data;
+
+/* the copy being written out, and where we're up to */
+struct SaveData save_pending;
+int save_slot = 0;
+int save_position = 0;
+int save_writing = 0;
+
+/* add up the save data, not including the checksum itself */
+unsigned int save_checksum(const struct SaveData* data) {
+    const unsigned int* words = (const unsigned int*) data;
+    unsigned int sum = 0x1234;
+    for (int i = 0; i < (int) (sizeof(struct SaveData) / 4) - 1; i++) {
+        sum = ((sum << 5) | (sum >> 27)) + words[i];
+    }
+    return sum;
+}
+
+/* read one slot from SRAM, returns whether it was good */
+int save_read_slot(int slot, struct SaveData* data) {
+    unsigned char* bytes = (unsigned char*) data;
+    for (int i = 0; i < (int) sizeof(struct SaveData); i++) {
+        bytes[i] = save_memory[slot * SAVE_SLOT_SIZE + i];
+    }
+    return data->magic == SAVE_MAGIC && data->checksum == save_checksum(data);
+}
+
+/* load the newest good save, or start fresh if there isn't one */
+void save_init() {
+    struct SaveData slots[2];
+    int good0 = save_read_slot(0, &slots[0]);
+    int good1 = save_read_slot(1, &slots[1]);
+
+    if (good0 && (!good1 || slots[0].sequence >= slots[1].sequence)) {
+        save_data = slots[0];
+        save_slot = 0;
+    } else if (good1) {
+        save_data = slots[1];
+        save_slot = 1;
+    } else {
+        unsigned int* words = (unsigned int*) &save_data;
+        for (int i = 0; i < (int) (sizeof(struct SaveData) / 4); i++) {
+            words[i] = 0;
+        }
+        save_data.magic = SAVE_MAGIC;
+        save_slot = 1;
+    }
+    save_writing = 0;
+}
+
+/* queue the save data to be written into the older slot, if a save is still
+ * being written it starts over with the new data in the same slot */
+void save_request() {
+    if (!save_writing) {
+        save_slot ^= 1;
+    }
+    save_data.sequence++;
+    save_data.checksum = save_checksum(&save_data);
+    save_pending = save_data;
+    save_position = 0;
+    save_writing = 1;
+}
+
+/* write a few bytes of the queued save, call this once a frame */
+void save_update() {
+    if (!save_writing) {
+        return;
+    }
+    const unsigned char* bytes = (const unsigned char*) &save_pending;
+    volatile unsigned char* dest = save_memory + save_slot * SAVE_SLOT_SIZE;
+    for (int i = 0; i < SAVE_BYTES_PER_FRAME && save_position < (int) sizeof(struct SaveData); i++) {
+        dest[save_position] = bytes[save_position];
+        save_position++;
+    }
+    if (save_position == (int) sizeof(struct SaveData)) {
+        save_writing = 0;
+    }
+}
+
+/* record how a run went and save it if it beat anything */
+void save_record_run(unsigned int score, unsigned int speed, struct Xorshift seed) {
+    int changed = 0;
+    if (score > save_data.high_score) {
+        save_data.high_score = score;
+
+        /* keep the seed so the best run can be replayed */
+        for (int i = SAVE_SEEDS - 1; i > 0; i--) {
+            save_data.replay_seeds[i] = save_data.replay_seeds[i - 1];
+        }
+        save_data.replay_seeds[0] = seed.state;
+        changed = 1;
+    }
+    if (speed > save_data.best_speed) {
+        save_data.best_speed = speed;
+        changed = 1;
+    }
+    if (changed) {
+        save_request();
+    }
+}
+
+/* a copy into VRAM for the next vblank, the game logic queues these so it
+ * doesn't have to be running in vblank and the vblank interrupt does them,
+ * if source is 0 the count halfwords are all set to value instead */
+struct VramUpload {
+    volatile unsigned short* dest;
+    const unsigned short* source;
+    unsigned short count;
+    unsigned short value;
+};
+RING_DEFINE(VramRing, struct VramUpload, 32)
+struct VramRing vram_uploads;
+
+/* queue a copy or a fill, returns 0 if the queue is full */
+int vram_upload(volatile unsigned short* dest, const unsigned short* source,
+        unsigned short count, unsigned short value) {
+    struct VramUpload upload = { dest, source, count, value };
+    return VramRing_push(&vram_uploads, &upload);
+}
+
+/* do all the queued copies, the vblank interrupt calls this
+ * the copies are done with the cpu since the main loop could be partway
+ * through setting up DMA 3 when the interrupt comes */
+void vram_uploads_flush() {
+    struct VramUpload upload;
+    while (VramRing_pop(&vram_uploads, &upload)) {
+        for (int i = 0; i < upload.count; i++) {
+            upload.dest[i] = upload.source ? upload.source[i] : upload.value;
+        }
+    }
+}
+
+/* the HUD shows the score and speed on background 2, which never scrolls
+ * where its glyphs and map go in VRAM is worked out by vram_plan */
+
+/* the HUD uses the last palette bank, 1 is the digits and 2 their shadow */
+#define HUD_PALETTE_BANK 15
+
+/* the digits, one byte per row with the leftmost pixel in the top bit */
+const unsigned char hud_font[10 * 8] = {
+    0x38, 0x44, 0x4c, 0x54, 0x64, 0x44, 0x38, 0x00,   /* 0 */
+    0x10, 0x30, 0x10, 0x10, 0x10, 0x10, 0x38, 0x00,   /* 1 */
+    0x38, 0x44, 0x04, 0x08, 0x10, 0x20, 0x7c, 0x00,   /* 2 */
+    0x7c, 0x08, 0x10, 0x08, 0x04, 0x44, 0x38, 0x00,   /* 3 */
+    0x08, 0x18, 0x28, 0x48, 0x7c, 0x08, 0x08, 0x00,   /* 4 */
+    0x7c, 0x40, 0x78, 0x04, 0x04, 0x44, 0x38, 0x00,   /* 5 */
+    0x18, 0x20, 0x40, 0x78, 0x44, 0x44, 0x38, 0x00,   /* 6 */
+    0x7c, 0x04, 0x08, 0x10, 0x20, 0x20, 0x20, 0x00,   /* 7 */
+    0x38, 0x44, 0x44, 0x38, 0x44, 0x44, 0x38, 0x00,   /* 8 */
+    0x38, 0x44, 0x44, 0x3c, 0x04, 0x08, 0x30, 0x00,   /* 9 */
+};
+
+/* tile 0 is left blank, the digit n is tile n + 1 */
+#define HUD_TILE_DIGIT 1
+#define HUD_TILES 11
+
+/* the glyphs as 4bpp tiles, built by hud_init and loaded along with the
+ * other layers */
+unsigned int hud_tiles[HUD_TILES * 8];
+const unsigned int* hud_tile_data = hud_tiles;
+
+/* the HUD's screen block, set by vram_plan */
+int hud_screen_block = 0;
+
+/* a number kept as decimal digits so showing it never needs a division,
+ * each digit which changes sets its bit in dirty so only it gets redrawn */
+#define BCD_DIGITS 6
+struct BcdCounter {
+    /* the digits, least significant first */
+    unsigned char digits[BCD_DIGITS];
+
+    /* how many digits are shown, and where the leftmost one goes on screen */
+    int shown;
+    int x, y;
+
+    /* one bit for each digit that needs to be drawn */
+    unsigned int dirty;
+};
+
+struct BcdCounter hud_score;
+struct BcdCounter hud_speed;
+
+#ifdef MEMORY_OVERLAY
+/* the memory overlay along the bottom, from the left the level, game and
+ * scratch arena peaks in bytes and the entities in use */
+struct BcdCounter hud_level_peak;
+struct BcdCounter hud_game_peak;
+struct BcdCounter hud_scratch_peak;
+struct BcdCounter hud_entities;
+#endif
+
+/* set a counter back to zero, which redraws all of it */
+void bcd_clear(struct BcdCounter* counter) {
+    for (int i = 0; i < BCD_DIGITS; i++) {
+        counter->digits[i] = 0;
+    }
+    counter->dirty = (1 << counter->shown) - 1;
+}
+
+/* add to a counter by adding to the ones digit and carrying up */
+void bcd_add(struct BcdCounter* counter, unsigned int amount) {
+    unsigned int carry = amount;
+    for (int i = 0; i < BCD_DIGITS && carry; i++) {
+        unsigned int digit = counter->digits[i] + carry;
+        carry = 0;
+        while (digit >= 10) {
+            digit -= 10;
+            carry++;
+        }
+        if (digit != counter->digits[i]) {
+            counter->digits[i] = digit;
+
+            /* digits past the ones shown are never drawn, so they must not
+             * be left dirty or the commit would never get to skip */
+            if (i < counter->shown) {
+                counter->dirty |= 1 << i;
+            }
+        }
+    }
+}
+
+#ifdef MEMORY_OVERLAY
+/* set a counter to a number, which can go down as well as up, a digit at a
+ * time by subtracting so it still never needs a division */
+void bcd_set(struct BcdCounter* counter, unsigned int value) {
+    static const unsigned int powers[BCD_DIGITS] = { 1, 10, 100, 1000, 10000, 100000 };
+    for (int i = BCD_DIGITS - 1; i >= 0; i--) {
+        unsigned int digit = 0;
+        while (value >= powers[i] && digit < 9) {
+            value -= powers[i];
+            digit++;
+        }
+        if (digit != counter->digits[i]) {
+            counter->digits[i] = digit;
+            if (i < counter->shown) {
+                counter->dirty |= 1 << i;
+            }
+        }
+    }
+}
+
+/* put a counter at a spot on the HUD */
+void bcd_place(struct BcdCounter* counter, int shown, int x, int y) {
+    counter->shown = shown;
+    counter->x = x;
+    counter->y = y;
+}
+#endif
+
+/* queue the digits of a counter which changed to be drawn in vblank, any
+ * which don't fit in the queue stay dirty for next time */
+void bcd_commit(struct BcdCounter* counter) {
+    if (!counter->dirty) {
+        return;
+    }
+    volatile unsigned short* map = screen_block(hud_screen_block) + counter->y * 32 + counter->x;
+    for (int i = 0; i < counter->shown; i++) {
+        if (counter->dirty & (1 << i)) {
+            unsigned short entry = (HUD_TILE_DIGIT + counter->digits[i]) | (HUD_PALETTE_BANK << 12);
+            if (vram_upload(&map[counter->shown - 1 - i], 0, 1, entry)) {
+                counter->dirty &= ~(1 << i);
+            }
+        }
+    }
+}
+
+/* make the digit tiles and clear the HUD map, vram_plan has to be called
+ * first so we know where the map goes */
+void hud_init() {
+    /* each row of a 4bpp tile is one 32 bit word, a nibble per pixel with
+     * the leftmost in the low bits, the shadow is one down and to the right */
+    for (int i = 0; i < 8; i++) {
+        hud_tiles[i] = 0;
+    }
+    for (int d = 0; d < 10; d++) {
+        for (int y = 0; y < 8; y++) {
+            unsigned int row = hud_font[d * 8 + y];
+            unsigned int shadow = y > 0 ? (hud_font[d * 8 + y - 1] >> 1) & ~row : 0;
+            unsigned int word = 0;
+            for (int x = 0; x < 8; x++) {
+                if (row & (0x80 >> x)) {
+                    word |= 1 << (x * 4);
+                } else if (shadow & (0x80 >> x)) {
+                    word |= 2 << (x * 4);
+                }
+            }
+            hud_tiles[(HUD_TILE_DIGIT + d) * 8 + y] = word;
+        }
+    }
+
+    volatile unsigned short* map = screen_block(hud_screen_block);
+    for (int i = 0; i < 32 * 32; i++) {
+        map[i] = 0;
+    }
+
+    palette_source[HUD_PALETTE_BANK * 16 + 1] = 0x7fff;
+    palette_source[HUD_PALETTE_BANK * 16 + 2] = 0x0000;
+    palette_rebuild();
+
+    /* the score goes in the top right and the speed in the top left */
+    hud_score.shown = 6;
+    hud_score.x = 29 - 6;
+    hud_score.y = 1;
+    hud_speed.shown = 3;
+    hud_speed.x = 1;
+    hud_speed.y = 1;
+
+#ifdef MEMORY_OVERLAY
+    bcd_place(&hud_level_peak, 6, 1, 18);
+    bcd_place(&hud_game_peak, 6, 8, 18);
+    bcd_place(&hud_scratch_peak, 6, 15, 18);
+    bcd_place(&hud_entities, 2, 27, 18);
+#endif
+}
+
+/* start a new run with everything at zero */
+void hud_reset() {
+    bcd_clear(&hud_score);
+    bcd_clear(&hud_speed);
+#ifdef MEMORY_OVERLAY
+    bcd_clear(&hud_level_peak);
+    bcd_clear(&hud_game_peak);
+    bcd_clear(&hud_scratch_peak);
+    bcd_clear(&hud_entities);
+#endif
+}
+
+/* queue the redraw of what changed, this costs almost nothing when the
+ * numbers haven't changed */
+void hud_commit() {
+    bcd_commit(&hud_score);
+    bcd_commit(&hud_speed);
+#ifdef MEMORY_OVERLAY
+    bcd_set(&hud_level_peak, memory_stats.level_peak);
+    bcd_set(&hud_game_peak, memory_stats.game_peak);
+    bcd_set(&hud_scratch_peak, memory_stats.scratch_peak);
+    bcd_set(&hud_entities, memory_stats.entities);
+    bcd_commit(&hud_level_peak);
+    bcd_commit(&hud_game_peak);
+    bcd_commit(&hud_scratch_peak);
+    bcd_commit(&hud_entities);
+#endif
+}
+
+/* the background layers are described here and vram_plan works out which
+ * char and screen blocks each one uses, layers which use the same tiles
+ * share one copy of them */
+struct Layer {
+    /* the control register and the settings that go in it */
+    volatile unsigned short* control;
+    int priority;
+    int wrap;
+
+    /* the tiles, given as the address of the pointer to them since the
+     * assets are only found at startup */
+    const void* const* tiles;
+    unsigned int tile_bytes;
+
+    /* the 32x32 map, and the palette bank of each tile to add to it, or 0 if
+     * the layer draws its own map */
+    const unsigned short* const* map;
+    const unsigned char* const* banks;
+
+    /* filled in by the planner */
+    int char_block;
+    int screen_block;
+    int shares_tiles;
+};
+
+/* background 0 (mapBack) is the ground the koopas run on, 1 (map2) is a
+ * mostly see-through layer drawn in front of it, and 2 is the HUD over the
+ * top of everything */
+#define BACKGROUND_TILE_BYTES (background_4bpp_tiles * 32)
+struct Layer layers[] = {
+    { (volatile unsigned short*) 0x4000008, 2, 1,
+      (const void* const*) &background_4bpp_data, BACKGROUND_TILE_BYTES,
+      &mapBack, &background_tile_bank, 0, 0, 0 },
+    { (volatile unsigned short*) 0x400000a, 1, 1,
+      (const void* const*) &background_4bpp_data, BACKGROUND_TILE_BYTES,
+      &map2, &background_tile_bank, 0, 0, 0 },
+    { (volatile unsigned short*) 0x400000c, 0, 0,
+      (const void* const*) &hud_tile_data, HUD_TILES * 32,
+      0, 0, 0, 0, 0 },
+};
+#define NUM_LAYERS (sizeof(layers) / sizeof(layers[0]))
+#define LAYER_HUD 2
+
+/* a copy into VRAM the loader has to do, maps get their tile's palette bank
+ * added as they're copied */
+struct VramJob {
+    volatile unsigned short* dest;
+    const unsigned short* source;
+    int count;
+    const unsigned char* banks;
+};
+struct VramJob vram_jobs[NUM_LAYERS * 2];
+int num_vram_jobs = 0;
+
+/* stop for good with a red screen, for a layout that can't work, there's
+ * no point going on to draw garbage */
+void vram_plan_failed() {
+    *display_control = MODE0;
+    bg_palette[0] = 0x001f;
+    while (1) {
+        halt();
+    }
+}
+
+/* assign the blocks, set the control registers and list the copies to do,
+ * tiles go in char blocks from the bottom up and maps in screen blocks from
+ * the top down so they stay out of each other's way */
+void vram_plan() {
+    int next_char = 0;
+    int next_screen = 31;
+    num_vram_jobs = 0;
+
+    for (int i = 0; i < (int) NUM_LAYERS; i++) {
+        struct Layer* layer = &layers[i];
+
+        /* share the char block of an earlier layer with the same tiles */
+        layer->shares_tiles = 0;
+        for (int j = 0; j < i; j++) {
+            if (*layers[j].tiles == *layer->tiles) {
+                layer->char_block = layers[j].char_block;
+                layer->shares_tiles = 1;
+                break;
+            }
+        }
+        if (!layer->shares_tiles) {
+            layer->char_block = next_char;
+            next_char += (layer->tile_bytes + 0x3fff) / 0x4000;
+
+            struct VramJob* job = &vram_jobs[num_vram_jobs++];
+            job->dest = char_block(layer->char_block);
+            job->source = *layer->tiles;
+            job->count = layer->tile_bytes / 2;
+            job->banks = 0;
+        }
+
+        layer->screen_block = next_screen--;
+        if (layer->map) {
+            struct VramJob* job = &vram_jobs[num_vram_jobs++];
+            job->dest = screen_block(layer->screen_block);
+            job->source = *layer->map;
+            job->count = 32 * 32;
+            job->banks = *layer->banks;
+        }
+
+        /* set all the control bits in this register */
+        *layer->control = layer->priority |   /* priority, 0 is highest, 3 is lowest */
+            (layer->char_block << 2) |        /* the char block the image data is stored in */
+            (0 << 6) |                        /* the mosaic flag */
+            (0 << 7) |                        /* color mode, 0 is 16 colors, 1 is 256 colors */
+            (layer->screen_block << 8) |      /* the screen block the tile data is stored in */
+            (layer->wrap << 13) |             /* wrapping flag */
+            (0 << 14);                        /* bg size, 0 is 256x256 */
+    }
+
+    /* each char block is as big as 8 screen blocks, so the tiles must end
+     * at or below the lowest map, and the backgrounds only get 4 char blocks */
+    if (next_char > 4 || next_char * 8 > next_screen + 1) {
+        vram_plan_failed();
+    }
+
+    hud_screen_block = layers[LAYER_HUD].screen_block;
+}
+
+/* how many halfwords to copy in one slice */
+#define VRAM_SLICE 512
+
+/* do one slice of the copies vram_plan listed, returns 1 once they're done
+ * the position counts halfwords through all of the jobs one after another */
+int vram_load_step(struct Task* task) {
+    if (task->position == 0) {
+        /* load the palette banks from the image, it goes to palette memory
+         * the next time the palette is committed */
+        for (int i = 0; i < background_4bpp_banks * 16; i++) {
+            palette_source[i] = background_4bpp_palette[i];
+        }
+        palette_rebuild();
+    }
+
+    int start = task->position;
+    int end = start + VRAM_SLICE;
+    int base = 0;
+    for (int j = 0; j < num_vram_jobs; j++) {
+        struct VramJob* job = &vram_jobs[j];
+        int from = start - base;
+        int to = end - base;
+        if (from < 0) {
+            from = 0;
+        }
+        if (to > job->count) {
+            to = job->count;
+        }
+        if (job->banks) {
+            for (int i = from; i < to; i++) {
+                job->dest[i] = job->source[i] | (job->banks[job->source[i] & 0x3ff] << 12);
+            }
+        } else {
+            for (int i = from; i < to; i++) {
+                job->dest[i] = job->source[i];
+            }
+        }
+        base += job->count;
+    }
+
+    task->position = end;
+    return end >= base;
+}
+
+/* start loading the background a slice at a time */
+struct Task* setup_background_task() {
+    /* about a tenth of a frame each frame */
+    return task_add(vram_load_step, 28000);
+}
+
 // int add_asm(int a, int b);
 
 /* the main function */
+/* run ahead shows the screen one tick ahead of the game, so a press shows
+ * up a frame sooner, by running an extra tick with the buttons as they are
+ * now, sorting the sprites from that, then putting everything back
+ * build with RUN_AHEAD defined to have it on from the start */
+#ifdef RUN_AHEAD
+int run_ahead = 1;
+#else
+int run_ahead = 0;
+#endif
+
+/* everything a tick changes, apart from the scroll and speed which main
+ * keeps and the HUD and sound which run ahead leaves alone */
+struct Snapshot {
+    struct Koopa koopa;
+    struct Koopa2 koopa2;
+    struct Sprite koopa_sprite;
+    struct Sprite koopa2_sprite;
+    struct Obstacle obstacles[MAX_OBSTACLES];
+    struct Sprite obstacle_sprites[MAX_OBSTACLES];
+    struct SpriteLists sprite_lists;
+    int obstacle_next;
+    int obstacle_spawn_x;
+    struct Xorshift random;
+};
+struct Snapshot run_ahead_snapshot;
+
+/* whether the shadow OAM has the run ahead tick in it, its scroll and where
+ * the koopa is in it */
+int run_ahead_ready = 0;
+int run_ahead_xscroll = 0;
+int run_ahead_koopa_y = 0;
+
+/* copy the game state into a snapshot */
+void snapshot_save(struct Snapshot* snapshot, struct Koopa* koopa, struct Koopa2* koopa2) {
+    snapshot->koopa = *koopa;
+    snapshot->koopa2 = *koopa2;
+    snapshot->koopa_sprite = *koopa->sprite;
+    snapshot->koopa2_sprite = *koopa2->sprite;
+    for (int i = 0; i < MAX_OBSTACLES; i++) {
+        snapshot->obstacles[i] = obstacles[i];
+        snapshot->obstacle_sprites[i] = *obstacles[i].sprite;
+    }
+    sprite_lists_save(&snapshot->sprite_lists);
+    snapshot->obstacle_next = obstacle_next;
+    snapshot->obstacle_spawn_x = obstacle_spawn_x;
+    snapshot->random = random_save();
+}
+
+/* put the game state back the way it was in a snapshot */
+void snapshot_restore(const struct Snapshot* snapshot, struct Koopa* koopa, struct Koopa2* koopa2) {
+    *koopa = snapshot->koopa;
+    *koopa2 = snapshot->koopa2;
+    *koopa->sprite = snapshot->koopa_sprite;
+    *koopa2->sprite = snapshot->koopa2_sprite;
+    for (int i = 0; i < MAX_OBSTACLES; i++) {
+        obstacles[i] = snapshot->obstacles[i];
+        *obstacles[i].sprite = snapshot->obstacle_sprites[i];
+    }
+
+    /* a sprite taken by a spawn goes back on the free list, and one given
+     * back by a recycle is live again with what it had in it above */
+    sprite_lists_restore(&snapshot->sprite_lists);
+    obstacle_next = snapshot->obstacle_next;
+    obstacle_spawn_x = snapshot->obstacle_spawn_x;
+    random_restore(snapshot->random);
+}
+
+/* run one tick ahead the same way main does but without sounds or the HUD,
+ * sort the sprites for the next commit, then undo it */
+void run_ahead_tick(struct Koopa* koopa, struct Koopa2* koopa2, int xscroll, int speed) {
+    profile_start();
+    snapshot_save(&run_ahead_snapshot, koopa, koopa2);
+
+    if (button_pressed(BUTTON_UP)) {
+        speed = speed + 1;
+        koopa_start_jump(koopa);
+    }
+    koopa_update(koopa, xscroll);
+    koopa2_update(koopa2, xscroll);
+    koopa2_script(koopa2, speed);
+    xscroll = xscroll + speed;
+    obstacles_update(xscroll, speed);
+
+    sprite_sort();
+    run_ahead_xscroll = xscroll;
+    run_ahead_koopa_y = koopa->y;
+    run_ahead_ready = 1;
+
+    snapshot_restore(&run_ahead_snapshot, koopa, koopa2);
+    profile_cycles[PROFILE_RUN_AHEAD] = profile_stop();
+}
+
+#ifdef LATENCY_TEST
+/* with LATENCY_TEST defined a press of up is put into the replay ring every
+ * couple of seconds as if the vblank interrupt had seen it, and the number of frames until the koopa is seen
+ * to move is kept here to be read out with an emulator's memory viewer */
+struct LatencyStats {
+    unsigned int presses;
+    unsigned int last, worst, total;
+};
+struct LatencyStats latency_stats;
+
+/* the vblank the press was made on, and where the koopa was then */
+unsigned int latency_press_vblank = 0;
+int latency_pending = 0;
+int latency_y;
+
+/* press up on a standing koopa every 128 frames, and let go the next */
+void latency_inject(struct Koopa* koopa) {
+    if (latency_pending || koopa->falling || (vblank_count & 127) != 0) {
+        return;
+    }
+    if (InputRing_count(&input_replay) > INPUT_RING_SIZE - 2) {
+        return;
+    }
+    struct InputEvent press = { input_keys & ~BUTTON_UP, vblank_count };
+    struct InputEvent release = { input_keys | BUTTON_UP, vblank_count + 1 };
+    if (InputRing_push(&input_replay, &press) && InputRing_push(&input_replay, &release)) {
+        latency_press_vblank = vblank_count;
+        latency_y = koopa->y;
+        latency_pending = 1;
+    }
+}
+
+/* call right after the commit, if the koopa that was just sent to the
+ * screen has moved up the jump is visible from this frame */
+void latency_check(struct Koopa* koopa) {
+    int shown = run_ahead_ready ? run_ahead_koopa_y : koopa->y;
+    if (latency_pending && shown < latency_y) {
+        unsigned int frames = vblank_count - latency_press_vblank;
+        latency_stats.presses++;
+        latency_stats.last = frames;
+        latency_stats.total += frames;
+        if (frames > latency_stats.worst) {
+            latency_stats.worst = frames;
+        }
+        latency_pending = 0;
+    }
+}
+#endif
+
+/* the keypad interrupt control register, it asks for an interrupt when the
+ * buttons in the low bits are pressed */
+volatile unsigned short* key_control = (volatile unsigned short*) 0x4000132;
+#define KEYCNT_IRQ 0x4000
+
+/* the display control bit which blanks the screen */
+#define FORCE_BLANK 0x80
+
+/* how dark the screen goes while paused, out of 16 */
+#define PAUSE_DIM 10
+
+/* after this many frames paused the display goes off and the cpu stops,
+ * which is a little over 30 seconds since vblank is about 59.73 Hz */
+#define PAUSE_STOP_FRAMES (60 * 30)
+
+/* wait with the cpu halted until start is in the state we want */
+void pause_wait_start(int down) {
+    while (((*buttons & BUTTON_START) == 0) != down) {
+        halt();
+    }
+}
+
+/* pause until start is pressed again, with the screen dimmed and the sound
+ * off, the cpu halts between vblanks and after a while goes into stop mode
+ * with the display off until the keypad interrupt wakes it */
+void game_pause() {
+    unsigned short sound = *sound_master;
+    *sound_master = 0;
+    *blend_control = BLEND_DARKEN_ALL;
+    *blend_brightness = PAUSE_DIM;
+
+    /* let go of the start press which paused us first */
+    pause_wait_start(0);
+
+    /* the keypad interrupt wakes the cpu up when start is pressed */
+    *key_control = KEYCNT_IRQ | BUTTON_START;
+    interrupt_set(INT_KEYPAD, interrupt_ignore);
+
+    unsigned int paused_at = vblank_count;
+    while (*buttons & BUTTON_START) {
+        if (vblank_count - paused_at >= PAUSE_STOP_FRAMES) {
+            /* there are no vblanks with the display off, only the keypad
+             * interrupt can wake us */
+            unsigned long display = *display_control;
+            *display_control = display | FORCE_BLANK;
+            stop();
+            *display_control = display;
+            paused_at = vblank_count;
+        } else {
+            halt();
+        }
+    }
+
+    /* the key interrupt keeps firing while start is held so turn it off
+     * before waiting for start to be let go */
+    interrupt_set(INT_KEYPAD, 0);
+    *key_control = 0;
+    pause_wait_start(0);
+
+    /* the fade puts the blending registers back in the next commit */
+    *sound_master = sound;
+    palette_dirty = 1;
+    wait_vblank();
+    palette_commit();
+}
+
 int main( ) {
     int bool = 0;
+
+    /* speed up ROM access */
+    waitstate_init();
+
+    /* find the assets in the pack */
+    assets_init();
+
+    /* start out black so nothing is seen while loading */
+    palette_fade(16, 0);
+    palette_commit();
+
+    /* set up where memory comes from */
+    memory_init();
+
+    /* find the top of the ground in each column of the level */
+    ground_build(mapBack, mapBack_width, mapBack_height, background_4bpp_data);
+
+    /* load the high scores */
+    save_init();
+
+    /* work out where everything goes in VRAM and set up the score display */
+    vram_plan();
+    hud_init();
+
+    /* start the sound, which swaps its buffers in the vblank interrupt */
+    sound_init();
+    scheduler_init();
+    interrupt_init();
+    *display_status |= DISPSTAT_VBLANK_IRQ;
+    interrupt_set(INT_VBLANK, interrupt_vblank);
+    *interrupt_master = 1;
+
     while(1){
         /* we set the mode to mode 0 with bg0 on */
-        *display_control = MODE0 | BG0_ENABLE | BG1_ENABLE | SPRITE_ENABLE | SPRITE_MAP_1D;
+        *display_control = MODE0 | BG0_ENABLE | BG1_ENABLE | BG2_ENABLE | SPRITE_ENABLE | SPRITE_MAP_1D;
 
-        /* setup the background 0 */
-        setup_background();
+        /* setup the background 0 a slice at a time, keeping the sound going
+         * while the screen is black */
+        setup_background_task();
+        while (tasks_pending()) {
+            wait_vblank();
+            scheduler_run();
+            sound_update();
+            save_update();
+        }
 
         /* setup the sprite image data */
         setup_sprite_image();
 
         /* clear all the sprites on screen now */
         sprite_clear();
+        affine_clear();
+
+#ifdef BENCHMARKS
+        affine_benchmark();
+        sound_benchmark();
+        script_benchmark();
+        random_benchmark();
+        waitstate_benchmark();
+        tile_query_benchmark();
+        interrupt_benchmark();
+#endif
+
+        /* throw away the last run's memory */
+        memory_new_level();
 
         /* create the koopa */
-        struct Koopa koopa;
-        struct Koopa2 koopa2;
-        koopa_init(&koopa);
-        koopa2_init(&koopa2);
+        struct Koopa* koopa = pool_alloc(&entity_pool);
+        struct Koopa2* koopa2 = pool_alloc(&entity_pool);
+        /* the koopas are the first sprites after sprite_clear so they
+         * always get a slot, obstacles which miss out are never spawned */
+        koopa_init(koopa);
+        koopa2_init(koopa2);
+        obstacles_init();
 
         /* set initial scroll to 0 */
         int xscroll = 0;
 
-        koopa_right(&koopa);
+        koopa_right(koopa);
+
+        /* reset the scroll now that the screen is black, then fade in */
+        *bg0_x_scroll = 0;
+        *bg1_x_scroll = 0;
+        sprite_update_all();
+        wait_vblank();
+        palette_commit();
+        sound_update();
+        palette_fade(0, 24);
+
         int gamestart = 0;
         int speed = 1;
+        int gamestate = 0;
+
+        /* the score is how far we've gone, in tiles */
+        int score = 0;
+        hud_reset();
+        bcd_add(&hud_speed, speed);
         // bool = 0;
-        /* loop forever */
-        while (1) {
-            /* update the koopa */
-            koopa_update(&koopa,&koopa2,xscroll);
-            koopa2_update(&koopa,&koopa2,xscroll);
 
+        /* the first run waits here for a button, the vblank it's pressed on
+         * seeds the random numbers before the level has used any, so the
+         * state saved below replays this run as well as the later ones */
+        input_flush();
+        while (!random_seeded) {
+            palette_update();
+            wait_vblank();
+            palette_commit();
+            input_poll(vblank_count);
+            random_seed_from_input(input_keys);
+            sound_update();
+            save_update();
+            scheduler_run();
+        }
+
+        /* remember the random state this run starts with */
+        run_start_random = random_save();
 
-            /* check for jumping */
-            if (button_pressed(BUTTON_UP)) {
-                // speed = add_asm(speed,1);
-                speed = speed + 1;
-                koopa_jump(&koopa);
-            }
+        /* the logic clock starts over from here */
+        timing.clock = vblank_count;
+        input_flush();
+#ifdef LATENCY_TEST
+        latency_pending = 0;
+#endif
+        unsigned int last_vblank = vblank_count;
 
+        /* loop forever */
+        while (1) {
+            /* wait for vblank before scrolling and moving sprites */
+            while (vblank_count == last_vblank) {
+                halt();
+            }
+            last_vblank = vblank_count;
+
+            /* commit the last tick to the screen once per frame, unless the
+             * logic ran so long we're past vblank, then skip this frame */
+            if (*scanline_counter >= 160) {
+                if (run_ahead_ready) {
+                    *bg1_x_scroll = run_ahead_xscroll;
+                    *bg0_x_scroll = GROUND_SCROLL(run_ahead_xscroll);
+                    sprite_upload();
+                } else {
+                    *bg1_x_scroll = xscroll;
+                    *bg0_x_scroll = GROUND_SCROLL(xscroll);
+                    sprite_update_all();
+                }
+                palette_commit();
+                timing.frames++;
+#ifdef LATENCY_TEST
+                latency_check(koopa);
+#endif
+            } else {
+                timing.skipped++;
+            }
 
-            koopa2_left(&koopa2,speed);
-            xscroll = xscroll + speed;
+#ifdef LATENCY_TEST
+            latency_inject(koopa);
+#endif
+
+            /* run a logic tick for every vblank since the last one, if we've
+             * fallen too far behind throw the extra ones away
+             * the buttons were read by the vblank interrupt just now, so
+             * running the logic straight away means a press is on screen
+             * at the very next vblank */
+            unsigned int due = vblank_count - timing.clock;
+            if (due > MAX_CATCHUP_TICKS) {
+                timing.dropped += due - MAX_CATCHUP_TICKS;
+                timing.clock += due - MAX_CATCHUP_TICKS;
+                due = MAX_CATCHUP_TICKS;
+            }
 
+            for (; due > 0 && gamestate == 0; due--) {
+                /* take the button changes up to the vblank this tick is for */
+                input_poll(timing.clock + 1);
+
+                /* check for jumping before moving so a jump starts this tick */
+                if (button_pressed(BUTTON_UP)) {
+                    // speed = add_asm(speed,1);
+                    speed = speed + 1;
+                    bcd_add(&hud_speed, 1);
+                    koopa_jump(koopa);
+                }
+
+                /* update the koopa */
+                koopa_update(koopa, xscroll);
+                koopa2_update(koopa2, xscroll);
+
+                koopa2_script(koopa2,speed);
+                xscroll = xscroll + speed;
+                bcd_add(&hud_score, (xscroll >> 3) - score);
+                score = xscroll >> 3;
+                palette_update();
+                memory_update_stats();
+
+                timing.clock++;
+                timing.ticks++;
+                obstacles_update(xscroll, speed);
+
+                gamestate = check(koopa,koopa2) || obstacles_hit(koopa, xscroll);
+            }
 
-            /* wait for vblank before scrolling and moving sprites */
-            wait_vblank();
+            /* show the next tick instead of this one if running ahead */
+            run_ahead_ready = 0;
+            if (run_ahead && gamestate == 0) {
+                run_ahead_tick(koopa, koopa2, xscroll, speed);
+            }
 
-            *bg1_x_scroll = xscroll;
-            *bg0_x_scroll = xscroll * 2;
-            sprite_update_all();
+            /* queue the score changes for the next vblank */
+            hud_commit();
+
+            /* the rest of the frame's work can wait until the logic is done */
+            sound_update();
+            save_update();
+            scheduler_run();
+
+            /* freeze everything while the game is paused, then start the
+             * logic clock again from now so it doesn't try to catch up */
+            if (gamestate == 0 && button_hit(BUTTON_START)) {
+                game_pause();
+                timing.clock = vblank_count;
+                last_vblank = vblank_count;
+                input_flush();
+            }
 
-            int gamestate = check(&koopa,&koopa2);
             if(gamestate == 1){
+                /* flash the koopas and fade out before starting over */
+                palette_flash(0x7fff, 12);
+                palette_fade(16, 24);
+                sound_queue(sound_crash, SOUND_CRASH_LENGTH, 4096, 64, 0);
+                save_record_run(score, speed, run_start_random);
+                while (palette_busy()) {
+                    palette_update();
+                    wait_vblank();
+                    palette_commit();
+                    sound_update();
+                    save_update();
+                }
 
                 break;
             }
             else{
                 bool = 0;
             }
-
-            /* delay some */
-            delay(300);
         }
     }
 }
 
 /* the game boy advance uses "interrupts" to handle certain situations
- * for now we will ignore these */
+ * for now we will ignore most of these */
 void interrupt_ignore( ) {
     /* do nothing */
 }
 
-/* this table specifies which interrupts we handle which way
- * for now, we ignore all of them */
-typedef void (*intrp)( );
+/* the vblank interrupt keeps time and the sound buffers in step with the
+ * screen, it reads the buttons and makes the VRAM changes the main loop
+ * queued, so each of those rings has one end here and one in the main loop */
+void interrupt_vblank( ) {
+    vblank_count++;
+    sound_vblank();
+    input_sample();
+    vram_uploads_flush();
+}
+
+/* the course crt0 dispatches through this table with its own handler, it's
+ * kept so that links but interrupt_init installs interrupt_master_isr over
+ * it, handlers are registered with interrupt_set now */
 const intrp IntrTable[13] = {
     interrupt_ignore,   /* V Blank interrupt */
     interrupt_ignore,   /* H Blank interrupt */